@@ -5,8 +5,22 @@
 #ifndef CRC__H
 #define CRC__H
 
+#include <cstddef>
+#include <cstdint>
+
 int crc32file(char *name, uint32_t *crc, long *charcnt);
 uint32_t crc32buf(const char *buf, size_t len);
+
+/* CRC32C (Castagnoli), hardware accelerated where the CPU supports it */
+uint32_t crc32c(const char *buf, size_t len);
+/* continue `crc` (a previous crc32c result) over `len` more bytes */
+uint32_t crc32c_extend(uint32_t crc, const char *buf, size_t len);
+bool crc32c_hardware_accelerated();
+/* `crc32c_extend` on the portable slicing-by-8 path, whatever the CPU */
+uint32_t crc32c_portable_extend(uint32_t crc, const char *buf, size_t len);
+
+/* TFRecord masking of a crc32c value */
+uint32_t mask_crc32c(uint32_t crc);
 uint32_t masked_crc32c(const char *buf, size_t len);
 
 #endif /* CRC__H */
@@ -0,0 +1,389 @@
+#ifndef TENSORBOARD_LOGGER_HISTOGRAM_H
+#define TENSORBOARD_LOGGER_HISTOGRAM_H
+
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// histograms reduce their input in blocks of this many values, the floating
+// point sums then do not depend on how many threads took part.
+const size_t kHistogramBlock = 1 << 16;
+
+// runs `task(i)` for every `i < num_tasks` and returns once all of them are
+// done, in any order and on any threads.
+typedef std::function<void(size_t num_tasks,
+                           const std::function<void(size_t)> &task)>
+    ParallelFor;
+
+// threads for `ParallelFor` loops, the calling thread takes part as well.
+// loops from several threads run one after the other.
+class WorkerPool {
+   public:
+    // `threads` in total, the calling one included.
+    explicit WorkerPool(size_t threads);
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+    ~WorkerPool();
+
+    size_t size() const { return threads_.size() + 1; }
+    void run(size_t num_tasks, const std::function<void(size_t)> &task);
+
+   private:
+    void work();
+    // claims and runs tasks of the current loop until none is left.
+    void run_tasks(std::unique_lock<std::mutex> &lock);
+
+    std::vector<std::thread> threads_;
+    std::mutex run_mutex_;
+    // guards everything below.
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(size_t)> *task_ = nullptr;
+    size_t num_tasks_ = 0;
+    size_t next_task_ = 0;
+    size_t unfinished_ = 0;
+    uint64_t loop_ = 0;
+    bool stop_ = false;
+};
+
+// IEEE 754 half precision and bfloat16 values are taken by their bits, from
+// buffers of uint16_t.  one value as a float:
+inline float float16_value(uint16_t bits) {
+    uint32_t sign = static_cast<uint32_t>(bits & 0x8000) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1f;
+    uint32_t mantissa = bits & 0x3ff;
+    if (exponent == 0) {
+        // zero or subnormal, mantissa * 2^-24.
+        float magnitude = mantissa * (1.0f / 16777216.0f);
+        return sign ? -magnitude : magnitude;
+    }
+    uint32_t result = sign | (mantissa << 13) | (exponent + 112) << 23;
+    if (exponent == 0x1f) {
+        // inf, or NaN made quiet the way F16C does.
+        result = sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0) << 22;
+    }
+    float value;
+    memcpy(&value, &result, sizeof(value));
+    return value;
+}
+
+inline float bfloat16_value(uint16_t bits) {
+    uint32_t result = static_cast<uint32_t>(bits) << 16;
+    float value;
+    memcpy(&value, &result, sizeof(value));
+    return value;
+}
+
+// `num` values as floats, 8 at a time with F16C / AVX2 where the CPU has
+// them.
+void to_float_fp16(const uint16_t *bits, size_t num, float *out);
+void to_float_bf16(const uint16_t *bits, size_t num, float *out);
+
+// maps a value to its TensorBoard histogram bucket: the index of the first
+// limit that is not less than the value, i.e. what `std::lower_bound` over
+// the limits returns, in constant time.
+//
+// the magnitude of a value picks a segment of the number line from its
+// exponent and top mantissa bits, so a segment spans a factor of at most
+// 2^(1/16).  per sign and segment a table holds the one limit the segment
+// can hold with geometric limits (the default ones grow by 1.1) and the
+// bucket of the values below it, a single comparison settles the rest.
+// limits that do not fit this (a segment with two limits) fall back to a
+// binary search.  arrays of floats and doubles go 4 values at a time with
+// AVX2 where the CPU has it.
+class BucketIndex {
+   public:
+    // `limits` sorted ascending.
+    explicit BucketIndex(std::vector<double> limits);
+
+    const std::vector<double> &limits() const { return limits_; }
+    size_t size() const { return limits_.size(); }
+
+    // NaN goes to the first bucket and +inf to the last one, where a binary
+    // search would point one past the end.
+    size_t operator()(double value) const {
+        if (!exact_) {
+            return search(value);
+        }
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint64_t magnitude_bits = bits & ~(uint64_t(1) << 63);
+        double magnitude;
+        memcpy(&magnitude, &magnitude_bits, sizeof(magnitude));
+        int64_t segment =
+            static_cast<int64_t>(magnitude_bits >> kSegmentShift) -
+            first_key_;
+        segment = segment < 0 ? 0 : segment;
+        segment = segment < num_segments_ ? segment : num_segments_ - 1;
+
+        // negative values (and -0) count down from their bucket as the
+        // magnitude grows.  no branches on the sign, which is a coin flip
+        // for weights.
+        size_t negative = bits >> 63;
+        segment += negative * num_segments_;
+        size_t past = segment_limits_[segment] < magnitude;
+        size_t index =
+            segment_buckets_[segment] + ((past ^ -negative) + negative);
+        index = index < limits_.size() ? index : limits_.size() - 1;
+        return index & -static_cast<size_t>(value == value);
+    }
+
+    // the buckets of `num` values.
+    void operator()(const double *values, size_t num, uint32_t *buckets) const;
+    void operator()(const float *values, size_t num, uint32_t *buckets) const;
+    template <typename T>
+    void operator()(const T *values, size_t num, uint32_t *buckets) const {
+        for (size_t i = 0; i < num; ++i) {
+            buckets[i] = (*this)(static_cast<double>(values[i]));
+        }
+    }
+
+   private:
+    // 11 exponent bits and 4 mantissa bits of a magnitude.
+    static const int kSegmentShift = 48;
+
+    // false if some segment holds more than one limit of a sign.
+    bool build(const std::vector<double> *magnitudes);
+    size_t search(double value) const;
+    template <typename T>
+    void index_all(const T *values, size_t num, uint32_t *buckets) const;
+
+    std::vector<double> limits_;
+    // positive segments, then negative ones.  the smallest limit magnitude
+    // at or above the segment start (NaN if there is none, for negative
+    // limits the next smaller double as their own magnitude is in the bucket
+    // below), and the bucket of the values of the segment below it.
+    // segments outside the table are clamped to its ends.
+    std::vector<double> segment_limits_;
+    std::vector<uint32_t> segment_buckets_;
+    int64_t first_key_ = 0;
+    int64_t num_segments_ = 0;
+    bool exact_ = false;
+};
+
+// running totals of a TensorBoard histogram over `BucketIndex` buckets.
+// values are summed block by block, `kHistogramBlock` values each from the
+// first one on, the last block stays open until it is full.  the totals of
+// consecutive pieces of some data are then the same as those of the data in
+// one piece, to the bit.
+struct BucketTotals {
+    std::vector<int64_t> counts;
+    uint64_t num = 0;
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    // of the full blocks.
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    double block_sum = 0.0;
+    double block_squares = 0.0;
+    size_t block_fill = 0;
+
+    double total_sum() const { return block_fill > 0 ? sum + block_sum : sum; }
+    double total_squares() const {
+        return block_fill > 0 ? sum_squares + block_squares : sum_squares;
+    }
+};
+
+// counts of a VisualDL histogram of `counts.size()` bins of equal `width`
+// from `start`.  a bin holds the values from its lower edge up to the next
+// one, the last bin its upper edge as well (as numpy.histogram does).
+// values outside go to the first or last bin, NaN to none.
+struct BinTotals {
+    BinTotals() = default;
+    BinTotals(int bins, double start, double width)
+        : start(start),
+          width(width),
+          scale(1.0 / width),
+          last(bins - 1),
+          counts(bins, 0) {}
+
+    double edge(size_t i) const { return start + width * i; }
+
+    // -1 for NaN.  the quotient may be rounded across an edge, one step
+    // towards the value settles it against the edges as emitted.
+    int64_t bin(double value) const {
+        double x = (value - start) * scale;
+        if (!(x == x)) {
+            return -1;
+        }
+        x = x > 0 ? x : 0;
+        x = x < last ? x : last;
+        int64_t bin = static_cast<int64_t>(x);
+        if (value < edge(bin)) {
+            bin -= bin > 0;
+        } else if (bin < last && value >= edge(bin + 1)) {
+            bin++;
+        }
+        return bin;
+    }
+
+    double start = 0.0;
+    double width = 0.0;
+    double scale = 0.0;
+    int64_t last = 0;
+    std::vector<int64_t> counts;
+};
+
+// the smallest and largest finite value of `num` values, `min` > `max` if
+// there is none.  floats, doubles and halves go 8 or 4 values at a time
+// with AVX2 where the CPU has it.
+void finite_range(const float *values, size_t num, double *min, double *max);
+void finite_range(const double *values, size_t num, double *min, double *max);
+void finite_range(const int8_t *values, size_t num, double *min, double *max);
+void finite_range(const uint8_t *values, size_t num, double *min,
+                  double *max);
+template <typename T>
+void finite_range(const T *values, size_t num, double *min, double *max) {
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -lo;
+    for (size_t i = 0; i < num; ++i) {
+        double v = static_cast<double>(values[i]);
+        if (v - v == 0) {
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+    }
+    *min = lo;
+    *max = hi;
+}
+void finite_range_fp16(const uint16_t *bits, size_t num, double *min,
+                       double *max);
+void finite_range_bf16(const uint16_t *bits, size_t num, double *min,
+                       double *max);
+
+// how the histograms read a chunk of values: `load` hands out `type`s, the
+// values themselves or a buffer of them converted, and `range` is their
+// `finite_range`.  halves come as uint16_t through `Float16Values` or
+// `BFloat16Values`, a plain uint16_t buffer holds integers.
+template <typename T>
+struct HistogramValues {
+    typedef T type;
+    static const T *load(const T *values, size_t, T *) { return values; }
+    static void range(const T *values, size_t num, double *min, double *max) {
+        finite_range(values, num, min, max);
+    }
+};
+
+struct Float16Values {
+    typedef float type;
+    static const float *load(const uint16_t *bits, size_t num,
+                             float *buffer) {
+        to_float_fp16(bits, num, buffer);
+        return buffer;
+    }
+    static void range(const uint16_t *bits, size_t num, double *min,
+                      double *max) {
+        finite_range_fp16(bits, num, min, max);
+    }
+};
+
+struct BFloat16Values {
+    typedef float type;
+    static const float *load(const uint16_t *bits, size_t num,
+                             float *buffer) {
+        to_float_bf16(bits, num, buffer);
+        return buffer;
+    }
+    static void range(const uint16_t *bits, size_t num, double *min,
+                      double *max) {
+        finite_range_bf16(bits, num, min, max);
+    }
+};
+
+// which values a sampled histogram looks at, for tensors too large to read
+// in full every few steps.  counts and sums are scaled up to the number of
+// values, `num` stays exact.
+struct HistogramSampling {
+    enum Method {
+        kStride,     // evenly spaced, from a random offset
+        kReservoir,  // uniformly at random, without replacement
+    };
+    Method method = kStride;
+    size_t max_values = 1 << 16;
+    // the same seed picks the same values.
+    uint64_t seed = 0;
+};
+
+// the ascending indices of `sampling.max_values` of `num` values, all of them
+// if there are no more.  O(max_values) time for both methods.  throws
+// std::invalid_argument if `max_values` is 0.
+std::vector<size_t> sample_indices(size_t num,
+                                   const HistogramSampling &sampling);
+
+// a mergeable quantile sketch (DDSketch, https://arxiv.org/abs/1908.10693).
+// buckets grow geometrically by gamma = (1 + a) / (1 - a), like the default
+// TensorBoard ones by 1.1, so any quantile comes back within a relative
+// error of `a`.  at most `max_bins` buckets per sign, past that the smallest
+// magnitudes are collapsed into one bucket.  NaN and inf count in `num` only.
+class DDSketch {
+   public:
+    struct Bucket {
+        double lower;
+        double upper;
+        uint64_t count;
+    };
+
+    explicit DDSketch(double relative_accuracy = 0.01, size_t max_bins = 2048);
+
+    void add(double value);
+    template <typename T>
+    void add(const T *values, size_t num) {
+        for (size_t i = 0; i < num; ++i) {
+            add(static_cast<double>(values[i]));
+        }
+    }
+    // both must have the same accuracy.
+    void merge(const DDSketch &other);
+
+    // `q` in [0, 1], NaN while nothing finite was added.
+    double quantile(double q) const;
+    // non empty buckets in ascending order, zeros in one of width 0.
+    std::vector<Bucket> buckets() const;
+
+    double relative_accuracy() const { return relative_accuracy_; }
+    uint64_t num() const { return num_; }
+    uint64_t count() const { return positive_.total + negative_.total + zeros_; }
+    double min() const { return min_; }
+    double max() const { return max_; }
+    double sum() const { return sum_; }
+    double sum_squares() const { return sum_squares_; }
+
+   private:
+    // counts of consecutive keys from `offset`.
+    struct Store {
+        void add(int64_t key, uint64_t count, size_t max_bins);
+
+        std::vector<uint64_t> counts;
+        int64_t offset = 0;
+        uint64_t total = 0;
+    };
+
+    // magnitudes in (gamma^(key - 1), gamma^key].
+    int64_t key(double magnitude) const {
+        return static_cast<int64_t>(std::ceil(std::log(magnitude) /
+                                              log_gamma_));
+    }
+    double bound(int64_t key) const { return std::exp(key * log_gamma_); }
+
+    double relative_accuracy_;
+    size_t max_bins_;
+    double log_gamma_;
+    Store positive_;
+    Store negative_;
+    uint64_t zeros_ = 0;
+    uint64_t num_ = 0;
+    double min_ = std::numeric_limits<double>::infinity();
+    double max_ = -std::numeric_limits<double>::infinity();
+    double sum_ = 0.0;
+    double sum_squares_ = 0.0;
+};
+
+#endif  // TENSORBOARD_LOGGER_HISTOGRAM_H
@@ -2,17 +2,30 @@
 #define TENSORBOARD_LOGGER_H
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <fstream>
 #include <iomanip>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <google/protobuf/arena.h>
+
 #include "crc.h"
 #include "event.pb.h"
+#include "histogram.h"
 #include "record.pb.h"
 
 using tensorflow::Event;
@@ -20,6 +33,8 @@ using tensorflow::Summary;
 
 using visualdl::Record;
 
+struct iovec;
+
 // extract parent dir from path by finding the last slash
 std::string get_parent_dir(const std::string &path);
 
@@ -29,6 +44,27 @@ const std::string kTextPluginName = "text";
 
 std::string read_binary_file(const std::string &filename);
 
+// read-only view of a whole file, mmap'ed so its bytes can go to the log
+// file without being copied.  falls back to `read_binary_file` when the file
+// can not be mapped (e.g. a pipe), an unreadable file is empty.
+class MappedFile {
+   public:
+    explicit MappedFile(const std::string &filename);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+   private:
+    void *mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    std::string fallback_;
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
 // todo: limit not checked.
 template <typename T>
 void calculate_hist_bins(T min, T max, int bins, T &start, T &width) {
@@ -51,7 +87,7 @@ void calculate_hist_bins(T min, T max, int bins, T &start, T &width) {
     T start_max = min;
 
     int sign = 1;
-    if (start_min < 0 && start_max > 0) {
+    if (start_min <= 0 && start_max >= 0) {
         start = 0.0;
         return;
     } else if (start_min < 0) {
@@ -65,50 +101,353 @@ void calculate_hist_bins(T min, T max, int bins, T &start, T &width) {
     order = floor(log10(start_min));
     start = exp10(order) * ceil(double(start_min) / exp10(order));
 
-    // todo: maybe the number of loop should be limited.
-    while (start > start_max) {
+    // a rounded width may leave no room between start_min and start_max,
+    // then the loop would run until exp10 underflows.  values past the
+    // edges are clamped to the end bins anyway.
+    for (int i = 0; start > start_max && i < 32; ++i) {
         order -= 1;
         start = exp10(order) * ceil(double(start_min) / exp10(order));
     }
+    if (!(start <= start_max)) {
+        start = start_max;
+    }
     start *= sign;
 }
 
+// when buffered records are handed to the OS.  flushing less often trades
+// freshness in the VisualDL / TensorBoard UI for throughput.
+struct FlushPolicy {
+    enum Mode {
+        kEveryRecord,  // write every record as soon as it is added
+        kEveryBytes,   // write once `bytes` bytes are buffered
+        kEveryMillis,  // write once the oldest buffered record is `millis` old
+        kExplicit,     // write only on `flush()` / `close()`
+    };
+    enum Durability {
+        kNoSync,     // leave it to the page cache
+        kFdatasync,  // fdatasync after every flush
+        kFsync,      // fsync after every flush
+    };
+
+    Mode mode = kEveryRecord;
+    size_t bytes = 0;
+    int64_t millis = 0;
+    Durability durability = kNoSync;
+
+    static FlushPolicy every_record(Durability durability = kNoSync) {
+        FlushPolicy policy;
+        policy.durability = durability;
+        return policy;
+    }
+    static FlushPolicy every_bytes(size_t bytes,
+                                   Durability durability = kNoSync) {
+        FlushPolicy policy;
+        policy.mode = kEveryBytes;
+        policy.bytes = bytes;
+        policy.durability = durability;
+        return policy;
+    }
+    // with a synchronous logger the age is only checked when a record is
+    // added, the async writer thread also wakes up on its own.
+    static FlushPolicy every_millis(int64_t millis,
+                                    Durability durability = kNoSync) {
+        FlushPolicy policy;
+        policy.mode = kEveryMillis;
+        policy.millis = millis;
+        policy.durability = durability;
+        return policy;
+    }
+    static FlushPolicy explicit_only(Durability durability = kNoSync) {
+        FlushPolicy policy;
+        policy.mode = kExplicit;
+        policy.durability = durability;
+        return policy;
+    }
+};
+
+// buffered bytes are written regardless of the flush policy beyond this, to
+// keep memory bounded under `kExplicit` and oversized `kEveryBytes`.
+const size_t kMaxBufferedBytes = 64 << 20;
+
+// growable byte buffer that keeps its storage across flushes, so framing a
+// record in steady state does not allocate.
+class OutputBuffer {
+   public:
+    OutputBuffer() = default;
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+    ~OutputBuffer() { delete[] data_; }
+
+    char *data() { return data_; }
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // storage is kept unless it grew beyond `kMaxBufferedBytes`, e.g. for a
+    // single huge image.
+    void clear();
+
+    // room for `n` more bytes at the end, they become part of the buffer
+    // once `commit(n)` is called.
+    char *reserve(size_t n) {
+        if (size_ + n > capacity_) grow(size_ + n);
+        return data_ + size_;
+    }
+    void commit(size_t n) { size_ += n; }
+    void append(const char *data, size_t n) {
+        memcpy(reserve(n), data, n);
+        commit(n);
+    }
+
+   private:
+    void grow(size_t min_capacity);
+
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+// VisualDL only: values of consecutive `add_*` calls are packed into one
+// Record, emitted once any enabled limit is reached or on `flush()`.  all
+// limits 0 (the default) emits one Record per value.
+struct RecordBatching {
+    size_t max_values = 0;
+    size_t max_bytes = 0;
+    // with a synchronous logger the age is only checked when a value is
+    // added, the async writer thread also wakes up on its own.
+    int64_t max_millis = 0;
+
+    bool enabled() const {
+        return max_values > 0 || max_bytes > 0 || max_millis > 0;
+    }
+};
+
+// when to roll over to a new log file: before a write would take the current
+// file past `max_bytes` or `max_records`, or once it is `max_millis` old.
+// records (or VisualDL batches) are never split across files, a single write
+// bigger than `max_bytes` still goes to one file.  all limits 0 (the default)
+// keeps one file.
+struct RotationPolicy {
+    uint64_t max_bytes = 0;
+    uint64_t max_records = 0;
+    // checked when records are written, an idle logger does not roll over.
+    int64_t max_millis = 0;
+
+    bool enabled() const {
+        return max_bytes > 0 || max_records > 0 || max_millis > 0;
+    }
+};
+
+// how `add_histogram*` spread large inputs over threads.  the result is the
+// same, bit for bit, with any number of threads.
+struct HistogramParallelism {
+    // in total, the calling thread included.  0 or 1 builds histograms on
+    // the calling thread only.
+    size_t threads = 0;
+    // the caller's own thread pool instead of `threads` internal ones, which
+    // still sets the number of tasks a histogram is split into.
+    ParallelFor executor;
+    // smaller inputs are not worth the hand-off.
+    size_t min_values = 1 << 20;
+};
+
+// wall times of a logger's records, for both formats.  the coarse clock is
+// the time of the last kernel tick (a few ms of resolution, nearly free to
+// read), the precise one has µs resolution for a few tens of ns per read.
+class WallClock {
+   public:
+    enum Source { kCoarse, kPrecise };
+
+    explicit WallClock(Source source = kCoarse);
+
+    // since the epoch.
+    int64_t micros() const;
+    int64_t millis() const { return micros() / 1000; }
+    double seconds() const { return micros() / 1e6; }
+
+   private:
+    int clock_id_;
+};
+
+struct LoggerOptions {
+    // hand every record to a background writer thread instead of serializing
+    // and writing it on the calling thread.
+    bool async = false;
+    // max number of records waiting for the writer thread, `add_*` blocks
+    // when the queue is full.
+    size_t max_pending_records = 1024;
+    // let several threads share the logger: every producer thread frames
+    // records into its own staging buffer and hands whole records to the
+    // file with a single append, so producers do not serialize on a lock.
+    // flush policy and record batching apply per thread.  can not be
+    // combined with `async`, whose queue already accepts any thread.
+    bool concurrent = false;
+    FlushPolicy flush_policy;
+    RecordBatching record_batching;
+    // VisualDL timestamps are in ms, TensorBoard wall times in seconds with
+    // µs precision.
+    WallClock::Source wall_clock = WallClock::kCoarse;
+    // append to the existing log instead of truncating it: the given
+    // tfevents file, or for VisualDL the latest `vdlrecords.*.log<suffix>`
+    // in the directory.  a torn record at its end, e.g. from a preempted
+    // run, is cut off first.  starts a new log if there is none.
+    bool resume = false;
+    // VisualDL rolls over to a new `vdlrecords.<timestamp>.log<suffix>`,
+    // TensorBoard to `<log_file>.<timestamp>`, the timestamp bumped where
+    // needed so names stay unique and in order.  the next file is opened
+    // ahead of time in the background.  with concurrent producers the size
+    // limits can be overshot by the writes racing the rollover.
+    RotationPolicy rotation;
+    HistogramParallelism histogram_parallelism;
+};
+
+// a tag together with its wire encoding as the `tag` field of a VisualDL
+// `Record.Value` and of a TensorBoard `Summary.Value`, both empty for an
+// empty tag.
+struct InternedTag {
+    std::string tag;
+    std::string vdl_field;
+    std::string tb_field;
+};
+
+// a tag registered with `TensorBoardLogger::register_tag`, cheap to copy.
+// only valid with the logger that issued it, for as long as it lives.
+class TagHandle {
+   public:
+    TagHandle() = default;
+    const std::string &tag() const {
+        assert(valid());
+        return interned_->tag;
+    }
+    bool valid() const { return interned_ != nullptr; }
+
+   private:
+    friend class TensorBoardLogger;
+    explicit TagHandle(const InternedTag *interned) : interned_(interned) {}
+
+    const InternedTag *interned_ = nullptr;
+};
+
+// the weights of the positives (tp) and negatives (fp) of a PR / ROC curve
+// per threshold bucket, binned the way VisualDL's python `compute_curve`
+// does with numpy.histogram.  numpy sums the weights `kBlock` values at a
+// time, so do these, and the last block stays open: pieces of the data add
+// up to what the data in one piece gives.
+struct CurveTotals {
+    static const size_t kBlock = 65536;
+
+    explicit CurveTotals(int num_thresholds);
+
+    // `weights` per prediction, `weight` for all of them if null.
+    void add(const double *labels, const double *predictions, size_t num,
+             const double *weights, double weight);
+    void add(const float *labels, const float *predictions, size_t num,
+             const float *weights, double weight);
+    void close_block();
+    void merge(const CurveTotals &other);
+    std::vector<double> total_tp() const;
+    std::vector<double> total_fp() const;
+
+    // the bin of each bucket index.
+    std::vector<int> bins;
+    std::vector<double> tp;
+    std::vector<double> fp;
+    // the open block, tp and fp of a bucket side by side so an update
+    // touches one cache line.
+    std::vector<double> block;
+    size_t block_fill = 0;
+};
+
+class HistogramAccumulator;
+class CurveAccumulator;
+
 class TensorBoardLogger {
+    friend class HistogramAccumulator;
+    friend class CurveAccumulator;
+
    public:
     explicit TensorBoardLogger(const char *log_file_or_dir,
                                bool visualdl = false,
-                               const std::string &suffix = "") {
-        bucket_limits_ = nullptr;
+                               const std::string &suffix = "",
+                               const LoggerOptions &options = LoggerOptions()) {
+        if (options.async && options.concurrent)
+            throw std::invalid_argument(
+                "async and concurrent modes can not be combined");
+        id_ = next_logger_id();
+        concurrent_ = options.concurrent;
+        flush_policy_ = options.flush_policy;
+        record_batching_ = options.record_batching;
+        histogram_parallelism_ = options.histogram_parallelism;
+        if (histogram_parallelism_.threads > 1 &&
+            !histogram_parallelism_.executor) {
+            histogram_pool_.reset(
+                new WorkerPool(histogram_parallelism_.threads));
+        }
+        clock_ = WallClock(options.wall_clock);
+        rotation_ = options.rotation;
+        visualdl_ = visualdl;
 
+        int64_t timestamp = -1;
         if (visualdl) {
-            std::stringstream time_str;
-            time_str << std::setw(10) << std::setfill('0') << time(nullptr);
-            std::string filename =
-                "vdlrecords." + time_str.str() + ".log" + suffix;
-
             // todo: create when not exists.
             log_dir_ = log_file_or_dir;
-            // todo: multiple platforms.
-            log_file_ = log_dir_ + "/" + filename;
-            ofs_ = new std::ofstream(
-                log_file_, std::ios::out | std::ios::trunc | std::ios::binary);
+            suffix_ = suffix;
+            if (options.resume) {
+                timestamp = latest_log_time();
+            }
+            if (timestamp < 0) {
+                timestamp = time(nullptr);
+            }
         } else {
-            ofs_ = new std::ofstream(log_file_or_dir, std::ios::out |
-                                                          std::ios::trunc |
-                                                          std::ios::binary);
+            base_file_ = log_file_or_dir;
             log_dir_ = get_parent_dir(log_file_or_dir);
+            if (options.resume) {
+                timestamp = latest_log_time();
+            }
         }
-        if (!ofs_->is_open())
+        // todo: multiple platforms.
+        log_file_ = log_file_name(timestamp);
+        name_time_ = std::max<int64_t>(timestamp, 0);
+        auto file = options.resume
+                        ? resume_log_file(log_file_, !visualdl_)
+                        : open_log_file(log_file_);
+        if (file == nullptr)
             throw std::runtime_error("failed to open log_file " +
                                      std::string(log_file_or_dir));
+        file->opened = std::chrono::steady_clock::now();
+        std::atomic_store(&file_, file);
+        staging_.last_flush = std::chrono::steady_clock::now();
+
+        if (options.async) {
+            max_pending_ = std::max<size_t>(options.max_pending_records, 1);
+            writer_ = std::thread(&TensorBoardLogger::writer_loop, this);
+        }
+        if (rotation_.enabled()) {
+            preopen_ = std::thread(&TensorBoardLogger::preopen_next_file, this,
+                                   std::shared_ptr<LogFile>());
+        }
     }
     ~TensorBoardLogger() {
-        ofs_->close();
-        if (bucket_limits_ != nullptr) {
-            delete bucket_limits_;
-            bucket_limits_ = nullptr;
-        }
+        close();
+        for (auto *arena : arenas_) delete arena;
     }
+
+    // block until every record added so far is handed to the OS, synced as
+    // requested by the flush policy.
+    int flush();
+    // for VisualDL the file name is generated inside `log_dir`.  the file
+    // records currently go to, which changes as the log is rotated.
+    std::string log_file() const;
+    // flush pending records, stop the writer thread and close the log file.
+    // further `add_*` calls are dropped.  in concurrent mode, no other
+    // thread may still be adding records.
+    int close();
+
+    // interns `tag` for the `TagHandle` overloads of `add_*`, which neither
+    // copy nor encode the tag per call.  registering a tag again returns the
+    // same handle.  with an async logger the queued messages still hold a
+    // copy of the tag.
+    TagHandle register_tag(const std::string &tag);
+
     int add_meta(const std::string &tag = std::string("meta_data_tag"),
                  const std::string &display_name = "", int64_t step = 0,
                  time_t timestamp = -1);
@@ -117,55 +456,42 @@ class TensorBoardLogger {
     int add_scalar(const std::string &tag, int step, double value,
                    time_t walltime = -1);
     int add_scalar_tb(const std::string &tag, int step, float value);
+    int add_scalar_tb(TagHandle tag, int step, double value);
+    int add_scalar(TagHandle tag, int step, double value,
+                   time_t walltime = -1);
+
+    // many scalars of one step as a single record / event, with one
+    // timestamp.
+    int add_scalars_tb(
+        int step, const std::vector<std::pair<std::string, double>> &scalars);
+    int add_scalars_tb(int step, const std::string *tags,
+                       const double *values, size_t num);
+    int add_scalars(int step,
+                    const std::vector<std::pair<std::string, double>> &scalars,
+                    time_t walltime = -1);
+    int add_scalars(int step, const std::string *tags, const double *values,
+                    size_t num, time_t walltime = -1);
 
-    // https://github.com/dmlc/tensorboard/blob/master/python/tensorboard/summary.py#L127
     template <typename T>
     int add_histogram_tb(const std::string &tag, int step, const T *value,
                          size_t num) {
-        if (bucket_limits_ == nullptr) {
-            generate_default_buckets();
-        }
-
-        std::vector<int> counts(bucket_limits_->size(), 0);
-        double min = std::numeric_limits<double>::max();
-        double max = std::numeric_limits<double>::lowest();
-        double sum = 0.0;
-        double sum_squares = 0.0;
-        for (size_t i = 0; i < num; ++i) {
-            T v = value[i];
-            auto lb = std::lower_bound(bucket_limits_->begin(),
-                                       bucket_limits_->end(), v);
-            counts[lb - bucket_limits_->begin()]++;
-            sum += v;
-            sum_squares += v * v;
-            if (v > max) {
-                max = v;
-            } else if (v < min) {
-                min = v;
-            }
-        }
-
-        auto *histo = new tensorflow::HistogramProto();
-        histo->set_min(min);
-        histo->set_max(max);
-        histo->set_num(num);
-        histo->set_sum(sum);
-        histo->set_sum_squares(sum_squares);
-        for (size_t i = 0; i < counts.size(); ++i) {
-            if (counts[i] > 0) {
-                histo->add_bucket_limit((*bucket_limits_)[i]);
-                histo->add_bucket(counts[i]);
-            }
-        }
-
-        auto *summary = new tensorflow::Summary();
+        auto *summary = new_summary();
         auto *v = summary->add_value();
         v->set_tag(tag);
-        v->set_allocated_histo(histo);
-
+        fill_histogram_tb(value, num, v->mutable_histo());
         return add_event(step, summary);
     };
 
+    template <typename T>
+    int add_histogram_tb(TagHandle tag, int step, const T *value,
+                         size_t num) {
+        const InternedTag &interned = checked_tag(tag);
+        auto *histo = google::protobuf::Arena::CreateMessage<
+            tensorflow::HistogramProto>(acquire_arena());
+        fill_histogram_tb(value, num, histo);
+        return add_histo_tb(interned, step, histo);
+    };
+
     template <typename T>
     int add_histogram_tb(const std::string &tag, int step,
                          const std::vector<T> &values) {
@@ -173,49 +499,68 @@ class TensorBoardLogger {
     };
 
     template <typename T>
-    int add_histogram(const std::string &tag, int step, int bins,
-                      const T *value, size_t num, time_t walltime = -1) {
-        T min = *std::min_element(value, value + num);
-        T max = *std::max_element(value, value + num);
+    int add_histogram_tb(TagHandle tag, int step,
+                         const std::vector<T> &values) {
+        return add_histogram_tb(tag, step, values.data(), values.size());
+    };
 
-        T width, start;
-        calculate_hist_bins(min, max, bins, start, width);
+    // a histogram of a sample of the values, scaled up to all of them.
+    template <typename T>
+    int add_histogram_tb(const std::string &tag, int step, const T *value,
+                         size_t num, const HistogramSampling &sampling) {
+        std::vector<T> sample = sample_values(value, num, sampling);
+        auto *summary = new_summary();
+        auto *v = summary->add_value();
+        v->set_tag(tag);
+        fill_histogram_tb(sample.data(), sample.size(), v->mutable_histo());
+        scale_histogram_tb(num, sample.size(), v->mutable_histo());
+        return add_event(step, summary);
+    };
 
-        std::vector<T> bin_bounds(bins + 1, 0);
-        bin_bounds[0] = start;
-        for (size_t t = 1; t < bins + 1; ++t) {
-            bin_bounds[t] = start + width * t;
-        }
+    template <typename T>
+    int add_histogram_tb(const std::string &tag, int step,
+                         const std::vector<T> &values,
+                         const HistogramSampling &sampling) {
+        return add_histogram_tb(tag, step, values.data(), values.size(),
+                                sampling);
+    };
 
-        std::vector<int> count(bins, 0);
-        for (size_t i = 0; i < num; ++i) {
-            auto ptr = std::lower_bound(bin_bounds.begin(), bin_bounds.end(),
-                                        value[i]);
-            if (ptr == bin_bounds.end()) {
-                count[bins - 1]++;
-            } else {
-                count[ptr - bin_bounds.begin()]++;
-            }
-        }
+    // the buckets of the sketch itself, not the default ones.
+    int add_histogram_tb(const std::string &tag, int step,
+                         const DDSketch &sketch);
 
-        auto *hist = new visualdl::Record_Histogram();
-        for (size_t i = 0; i < bins + 1; ++i) {
-            hist->add_bin_edges(bin_bounds[i]);
-        }
-        for (size_t i = 0; i < bins; ++i) {
-            hist->add_hist(count[i]);
-        }
+    // IEEE 754 half precision and bfloat16 values by their bits, converted
+    // to floats on the way.  a uint16_t buffer given to the templates above
+    // is taken as integers.
+    int add_histogram_tb_fp16(const std::string &tag, int step,
+                              const uint16_t *bits, size_t num);
+    int add_histogram_tb_bf16(const std::string &tag, int step,
+                              const uint16_t *bits, size_t num);
 
-        auto *record = new visualdl::Record();
+    template <typename T>
+    int add_histogram(const std::string &tag, int step, int bins,
+                      const T *value, size_t num, time_t walltime = -1) {
+        auto *record = new_record();
         auto v = record->add_values();
         v->set_id(step);
         v->set_tag(tag);
-        v->set_timestamp(walltime);
-        v->set_allocated_histogram(hist);
-
+        v->set_timestamp(walltime < 0 ? clock_.millis() : walltime);
+        fill_histogram(bins, value, num, v->mutable_histogram());
         return add_record(record);
     };
 
+    template <typename T>
+    int add_histogram(TagHandle tag, int step, int bins, const T *value,
+                      size_t num, time_t walltime = -1) {
+        const InternedTag &interned = checked_tag(tag);
+        auto *hist = google::protobuf::Arena::CreateMessage<
+            visualdl::Record_Histogram>(acquire_arena());
+        fill_histogram(bins, value, num, hist);
+        return add_histogram_value(interned, step,
+                                   walltime < 0 ? clock_.millis() : walltime,
+                                   hist);
+    };
+
     template <typename T>
     int add_histogram(const std::string &tag, int step, int bins,
                       const std::vector<T> &values, time_t walltime = -1) {
@@ -223,6 +568,51 @@ class TensorBoardLogger {
                              walltime);
     };
 
+    template <typename T>
+    int add_histogram(TagHandle tag, int step, int bins,
+                      const std::vector<T> &values, time_t walltime = -1) {
+        return add_histogram(tag, step, bins, values.data(), values.size(),
+                             walltime);
+    };
+
+    template <typename T>
+    int add_histogram(const std::string &tag, int step, int bins,
+                      const T *value, size_t num,
+                      const HistogramSampling &sampling,
+                      time_t walltime = -1) {
+        std::vector<T> sample = sample_values(value, num, sampling);
+        auto *record = new_record();
+        auto v = record->add_values();
+        v->set_id(step);
+        v->set_tag(tag);
+        v->set_timestamp(walltime < 0 ? clock_.millis() : walltime);
+        fill_histogram(bins, sample.data(), sample.size(),
+                       v->mutable_histogram());
+        scale_histogram(num, sample.size(), v->mutable_histogram());
+        return add_record(record);
+    };
+
+    template <typename T>
+    int add_histogram(const std::string &tag, int step, int bins,
+                      const std::vector<T> &values,
+                      const HistogramSampling &sampling,
+                      time_t walltime = -1) {
+        return add_histogram(tag, step, bins, values.data(), values.size(),
+                             sampling, walltime);
+    };
+
+    // one bin per bucket of the sketch, empty ones fill the gaps.
+    int add_histogram(const std::string &tag, int step,
+                      const DDSketch &sketch, time_t walltime = -1);
+
+    // halves by their bits, as `add_histogram_tb_fp16` takes them.
+    int add_histogram_fp16(const std::string &tag, int step, int bins,
+                           const uint16_t *bits, size_t num,
+                           time_t walltime = -1);
+    int add_histogram_bf16(const std::string &tag, int step, int bins,
+                           const uint16_t *bits, size_t num,
+                           time_t walltime = -1);
+
     // metadata (such as display_name, description) of the same tag will be
     // stripped to keep only the first one.
     int add_image_tb(const std::string &tag, int step,
@@ -231,6 +621,14 @@ class TensorBoardLogger {
                      const std::string &description = "");
     int add_image(const std::string &tag, int step,
                   const std::string &encoded_image, time_t walltime = -1);
+    // the `_from_path` variants map the file and write its bytes straight
+    // into the log file.  in async mode they wait for the queue to drain
+    // and write on the calling thread.
+    int add_image_from_path_tb(const std::string &tag, int step,
+                               const std::string &path, int height,
+                               int width, int channel,
+                               const std::string &display_name = "",
+                               const std::string &description = "");
     int add_image_from_path(const std::string &tag, int step,
                             const std::string &path, time_t walltime = -1);
     int add_images_tb(const std::string &tag, int step,
@@ -244,6 +642,12 @@ class TensorBoardLogger {
                      const std::string &content_type,
                      const std::string &display_name = "",
                      const std::string &description = "");
+    int add_audio_from_path_tb(const std::string &tag, int step,
+                               const std::string &path, float sample_rate,
+                               int num_channels, int length_frame,
+                               const std::string &content_type,
+                               const std::string &display_name = "",
+                               const std::string &description = "");
     int add_audio(const std::string &tag, int step,
                   const std::string &encoded_audio, float sample_rate,
                   time_t walltime = -1);
@@ -313,18 +717,685 @@ class TensorBoardLogger {
                   const std::vector<double> &predictions, int step,
                   int num_thresholds, time_t walltime, double weights);
 
+    // the same curves over `num` float labels and predictions, counted in
+    // place without a copy into doubles.
+    int add_pr_curve(const std::string &tag, const float *labels,
+                     const float *predictions, size_t num, int step,
+                     int num_thresholds = 127, time_t walltime = -1,
+                     double weights = 1.0);
+    int add_roc_curve(const std::string &tag, const float *labels,
+                      const float *predictions, size_t num, int step,
+                      int num_thresholds = 127, time_t walltime = -1,
+                      double weights = 1.0);
+    int add_curve(const std::string &type, const std::string &tag,
+                  const float *labels, const float *predictions, size_t num,
+                  int step, int num_thresholds, time_t walltime,
+                  double weights);
+
+    // a curve per class of a row major `num_samples` x `num_classes`
+    // matrix of predicted probabilities, tagged "<tag_prefix>/<class>" and
+    // written as a single record.  the matrix is swept on the histogram
+    // threads, once per chunk of classes whose sums fit in L2: a single
+    // pass for up to 258 classes at 127 thresholds, fewer classes per pass
+    // with more thresholds.  `labels` holds the class of each sample.
+    int add_pr_curves(const std::string &tag_prefix, const float *probs,
+                      const int32_t *labels, size_t num_samples,
+                      size_t num_classes, int step, int num_thresholds = 127,
+                      time_t walltime = -1);
+    int add_roc_curves(const std::string &tag_prefix, const float *probs,
+                       const int32_t *labels, size_t num_samples,
+                       size_t num_classes, int step, int num_thresholds = 127,
+                       time_t walltime = -1);
+    // `labels` is a matrix like `probs`, 1 where a sample has the class.
+    int add_multi_label_pr_curves(const std::string &tag_prefix,
+                                  const float *probs, const float *labels,
+                                  size_t num_samples, size_t num_classes,
+                                  int step, int num_thresholds = 127,
+                                  time_t walltime = -1);
+    int add_multi_label_roc_curves(const std::string &tag_prefix,
+                                   const float *probs, const float *labels,
+                                   size_t num_samples, size_t num_classes,
+                                   int step, int num_thresholds = 127,
+                                   time_t walltime = -1);
+
    private:
-    int generate_default_buckets();
+    // a record waiting for the writer thread, exactly one of the two is set.
+    // the message is released once it is written.
+    struct PendingWrite {
+        Event *event = nullptr;
+        Record *record = nullptr;
+    };
+
+    // everything needed to frame records: the output buffer, with the open
+    // batch record at its tail, and the flush bookkeeping.  the logger owns
+    // one, in concurrent mode every producer thread gets its own.
+    struct Staging {
+        Staging() = default;
+        Staging(const Staging &) = delete;
+        Staging &operator=(const Staging &) = delete;
+        ~Staging() { delete arena; }
+
+        OutputBuffer out;
+        std::chrono::steady_clock::time_point last_flush;
+
+        // the open batch starts at `batch_start` with a placeholder length
+        // prefix.
+        bool batch_open = false;
+        size_t batch_start = 0;
+        size_t batch_values = 0;
+        std::chrono::steady_clock::time_point batch_opened;
+
+        // whole records in `out`, an open batch counts once closed.
+        size_t records = 0;
+
+        // concurrent mode only: the thread's own arena, and a lock that is
+        // only contended when `flush` drains the buffer from another thread.
+        google::protobuf::Arena *arena = nullptr;
+        std::unique_ptr<char[]> arena_block;
+        std::mutex mutex;
+    };
+
+    // the number of tasks to split a histogram of `num` values into.
+    size_t histogram_tasks(size_t num) const;
+    // runs `task(i)` for every `i < num_tasks`, on the histogram threads.
+    void run_histogram_tasks(size_t num_tasks,
+                             const std::function<void(size_t)> &task);
+
+    // adds `num` more values to `totals`.  the open block is filled first,
+    // then every task takes a contiguous range of the full blocks and reduces
+    // each block on its own, the partial results are merged in block order.
+    // what is left opens the next block.
+    // https://github.com/dmlc/tensorboard/blob/master/python/tensorboard/summary.py#L127
+    template <typename T, typename Values = HistogramValues<T>>
+    void accumulate_histogram_tb(const T *value, size_t num,
+                                 BucketTotals *totals) {
+        const BucketIndex &buckets = bucket_index();
+        if (totals->counts.empty()) {
+            totals->counts.assign(buckets.size(), 0);
+        }
+        auto reduce = [&buckets, value](size_t begin, size_t end,
+                                        int64_t *counts, double *min,
+                                        double *max, double *sum,
+                                        double *sum_squares) {
+            reduce_histogram_tb(buckets, Values(), value, begin, end, counts,
+                                min, max, sum, sum_squares);
+        };
+
+        size_t done = 0;
+        if (totals->block_fill > 0) {
+            done = std::min(num, kHistogramBlock - totals->block_fill);
+            reduce(0, done, totals->counts.data(), &totals->min,
+                   &totals->max, &totals->block_sum, &totals->block_squares);
+            totals->block_fill += done;
+            if (totals->block_fill == kHistogramBlock) {
+                totals->sum += totals->block_sum;
+                totals->sum_squares += totals->block_squares;
+                totals->block_sum = 0.0;
+                totals->block_squares = 0.0;
+                totals->block_fill = 0;
+            }
+        }
+
+        size_t num_blocks = (num - done) / kHistogramBlock;
+        if (num_blocks > 0) {
+            size_t num_tasks = histogram_tasks(num_blocks * kHistogramBlock);
+            std::vector<double> sums(num_blocks);
+            std::vector<double> squares(num_blocks);
+            std::vector<std::vector<int64_t>> counts(num_tasks);
+            std::vector<double> mins(num_tasks);
+            std::vector<double> maxs(num_tasks);
+            run_histogram_tasks(num_tasks, [&](size_t task) {
+                auto &task_counts = counts[task];
+                task_counts.assign(buckets.size(), 0);
+                double min = std::numeric_limits<double>::max();
+                double max = std::numeric_limits<double>::lowest();
+                size_t last_block = num_blocks * (task + 1) / num_tasks;
+                for (size_t block = num_blocks * task / num_tasks;
+                     block < last_block; ++block) {
+                    size_t begin = done + block * kHistogramBlock;
+                    double sum = 0.0;
+                    double sum_squares = 0.0;
+                    reduce(begin, begin + kHistogramBlock, task_counts.data(),
+                           &min, &max, &sum, &sum_squares);
+                    sums[block] = sum;
+                    squares[block] = sum_squares;
+                }
+                mins[task] = min;
+                maxs[task] = max;
+            });
+
+            for (size_t task = 0; task < num_tasks; ++task) {
+                if (maxs[task] > totals->max) totals->max = maxs[task];
+                if (mins[task] < totals->min) totals->min = mins[task];
+                for (size_t i = 0; i < buckets.size(); ++i) {
+                    totals->counts[i] += counts[task][i];
+                }
+            }
+            for (size_t block = 0; block < num_blocks; ++block) {
+                totals->sum += sums[block];
+                totals->sum_squares += squares[block];
+            }
+            done += num_blocks * kHistogramBlock;
+        }
+
+        if (done < num) {
+            reduce(done, num, totals->counts.data(), &totals->min,
+                   &totals->max, &totals->block_sum, &totals->block_squares);
+            totals->block_fill = num - done;
+        }
+        totals->num += num;
+    }
+
+    // adds values [begin, end) to `counts`, the running min / max and the
+    // sums.  bucket indices go a chunk at a time, so they can be vectorized.
+    template <typename T, typename Values>
+    static void reduce_histogram_tb(const BucketIndex &buckets, Values,
+                                    const T *value, size_t begin, size_t end,
+                                    int64_t *counts, double *min, double *max,
+                                    double *sum, double *sum_squares) {
+        const size_t kChunk = 256;
+        uint32_t indices[kChunk];
+        typename Values::type buffer[kChunk];
+        for (size_t start = begin; start < end; start += kChunk) {
+            size_t chunk = std::min(kChunk, end - start);
+            const auto *chunk_values = Values::load(value + start, chunk,
+                                                    buffer);
+            buckets(chunk_values, chunk, indices);
+            for (size_t i = 0; i < chunk; ++i) {
+                auto v = chunk_values[i];
+                counts[indices[i]]++;
+                *sum += v;
+                *sum_squares += v * v;
+                if (v > *max) *max = v;
+                if (v < *min) *min = v;
+            }
+        }
+    }
+    // bytes are counted per value first, their sums are exact integers so
+    // the order they are added in does not matter.
+    static void reduce_histogram_tb(const BucketIndex &buckets,
+                                    HistogramValues<int8_t>,
+                                    const int8_t *value, size_t begin,
+                                    size_t end, int64_t *counts, double *min,
+                                    double *max, double *sum,
+                                    double *sum_squares);
+    static void reduce_histogram_tb(const BucketIndex &buckets,
+                                    HistogramValues<uint8_t>,
+                                    const uint8_t *value, size_t begin,
+                                    size_t end, int64_t *counts, double *min,
+                                    double *max, double *sum,
+                                    double *sum_squares);
+
+    void set_histogram_tb(const BucketTotals &totals,
+                          tensorflow::HistogramProto *histo) const;
+
+    template <typename T, typename Values = HistogramValues<T>>
+    void fill_histogram_tb(const T *value, size_t num,
+                           tensorflow::HistogramProto *histo) {
+        BucketTotals totals;
+        accumulate_histogram_tb<T, Values>(value, num, &totals);
+        set_histogram_tb(totals, histo);
+    }
+
+    // adds `num` more values to the fixed bins of `totals`.
+    template <typename T, typename Values = HistogramValues<T>>
+    void accumulate_bins(const T *value, size_t num, BinTotals *totals) {
+        size_t bins = totals->counts.size();
+        size_t num_tasks = histogram_tasks(num);
+        std::vector<std::vector<int64_t>> counts(num_tasks);
+        run_histogram_tasks(num_tasks, [&](size_t task) {
+            int64_t *count = totals->counts.data();
+            if (num_tasks > 1) {
+                counts[task].assign(bins, 0);
+                count = counts[task].data();
+            }
+            count_bins(*totals, Values(), value, num * task / num_tasks,
+                       num * (task + 1) / num_tasks, count);
+        });
+        if (num_tasks > 1) {
+            for (const auto &task_count : counts) {
+                for (size_t i = 0; i < bins; ++i) {
+                    totals->counts[i] += task_count[i];
+                }
+            }
+        }
+    }
+
+    // adds the bins of values [begin, end) to `count`.
+    template <typename T, typename Values>
+    static void count_bins(const BinTotals &totals, Values, const T *value,
+                           size_t begin, size_t end, int64_t *count) {
+        const size_t kChunk = 256;
+        typename Values::type buffer[kChunk];
+        for (size_t start = begin; start < end; start += kChunk) {
+            size_t chunk = std::min(kChunk, end - start);
+            const auto *chunk_values = Values::load(value + start, chunk,
+                                                    buffer);
+            for (size_t i = 0; i < chunk; ++i) {
+                int64_t bin = totals.bin(chunk_values[i]);
+                if (bin >= 0) count[bin]++;
+            }
+        }
+    }
+    static void count_bins(const BinTotals &totals, HistogramValues<int8_t>,
+                           const int8_t *value, size_t begin, size_t end,
+                           int64_t *count);
+    static void count_bins(const BinTotals &totals, HistogramValues<uint8_t>,
+                           const uint8_t *value, size_t begin, size_t end,
+                           int64_t *count);
+
+    // one pass for the range of the finite values, then every value goes
+    // straight to its bin.  NaN and inf do not move the edges, inf is
+    // counted in the first or last bin and NaN is left out.
+    template <typename T, typename Values = HistogramValues<T>>
+    void fill_histogram(int bins, const T *value, size_t num,
+                        visualdl::Record_Histogram *hist) {
+        size_t num_tasks = histogram_tasks(num);
+        std::vector<double> mins(num_tasks);
+        std::vector<double> maxs(num_tasks);
+        run_histogram_tasks(num_tasks, [&](size_t task) {
+            size_t begin = num * task / num_tasks;
+            size_t end = num * (task + 1) / num_tasks;
+            Values::range(value + begin, end - begin, &mins[task],
+                          &maxs[task]);
+        });
+        double min = mins[0];
+        double max = maxs[0];
+        for (size_t task = 1; task < num_tasks; ++task) {
+            if (mins[task] < min) min = mins[task];
+            if (maxs[task] > max) max = maxs[task];
+        }
+        // -0 and 0 compare equal, which one wins must not depend on the
+        // tasks.
+        min += 0.0;
+        max += 0.0;
+        if (!(min <= max)) {
+            // nothing finite.
+            min = 0.0;
+            max = 1.0;
+        } else if (min == max) {
+            min -= 0.5;
+            max += 0.5;
+        }
+
+        double start, width;
+        calculate_hist_bins(min, max, bins, start, width);
+        BinTotals totals(bins, start, width);
+        accumulate_bins<T, Values>(value, num, &totals);
+        set_histogram(totals, hist);
+    }
+
+    static void set_histogram(const BinTotals &totals,
+                              visualdl::Record_Histogram *hist);
+
+    template <typename T>
+    static std::vector<T> sample_values(const T *value, size_t num,
+                                        const HistogramSampling &sampling) {
+        std::vector<size_t> indices = sample_indices(num, sampling);
+        std::vector<T> sample;
+        sample.reserve(indices.size());
+        for (size_t i : indices) {
+            sample.push_back(value[i]);
+        }
+        return sample;
+    }
+    // scales a histogram of `sampled` of `num` values up to all of them.
+    static void scale_histogram_tb(size_t num, size_t sampled,
+                                   tensorflow::HistogramProto *histo);
+    static void scale_histogram(size_t num, size_t sampled,
+                                visualdl::Record_Histogram *hist);
+
+    // num_thresholds as the curves use it, at least 2 and with no upper
+    // bound.
+    static int curve_thresholds(int num_thresholds);
+    // fills in a "pr_curve" or "roc_curve" value from the bucket weights.
+    static void set_curve(const std::string &type, const CurveTotals &totals,
+                          visualdl::Record_Value *v);
+    template <typename Label>
+    int add_class_curves(const std::string &type,
+                         const std::string &tag_prefix, const float *probs,
+                         size_t num_samples, size_t num_classes, Label label,
+                         int step, int num_thresholds, time_t walltime);
+    // a "pr_curve" or "roc_curve" record of the bucket weights.
+    int write_curve(const std::string &type, const std::string &tag,
+                    int step, time_t walltime, const CurveTotals &totals);
+
+    // the tag behind `tag`, std::invalid_argument for a default constructed
+    // handle.
+    static const InternedTag &checked_tag(TagHandle tag) {
+        if (!tag.valid()) {
+            throw std::invalid_argument("invalid tag handle");
+        }
+        return *tag.interned_;
+    }
+    // emit a histogram under a registered tag, both take ownership of the
+    // message.
+    int add_histo_tb(const InternedTag &tag, int64_t step,
+                     tensorflow::HistogramProto *histo);
+    int add_histogram_value(const InternedTag &tag, int64_t step,
+                            int64_t walltime,
+                            visualdl::Record_Histogram *hist);
+
+    static uint64_t next_logger_id();
+    Staging &current_staging();
+
+    // the default TensorBoard buckets, built by the first histogram of any
+    // thread.
+    const BucketIndex &bucket_index();
+
+    // messages built by `add_*` live on an arena from `acquire_arena`, which
+    // goes back to the pool (after a reset) once the message is written.
+    google::protobuf::Arena *acquire_arena();
+    void release_message(google::protobuf::MessageLite *message);
+    Summary *new_summary() {
+        return google::protobuf::Arena::CreateMessage<Summary>(
+            acquire_arena());
+    }
+    Record *new_record() {
+        return google::protobuf::Arena::CreateMessage<Record>(
+            acquire_arena());
+    }
+
+    // both take ownership of the message.
     int add_event(int64_t step, Summary *summary);
-    inline int add_record(Record *record) { return write(*record); }
+    int add_record(Record *record);
+
+    int enqueue(PendingWrite &&pending);
+    void writer_loop();
 
     int write(Event &event);
     int write(Record &record);
+    // the scalars of an `add_scalar*` call, `tag(i)` and `value(i)` for
+    // `i < size()`, `interned(i)` for registered tags.
+    struct ScalarArrays {
+        const std::string *tags;
+        const double *values;
+        size_t num;
+
+        const std::string &tag(size_t i) const { return tags[i]; }
+        const InternedTag *interned(size_t) const { return nullptr; }
+        double value(size_t i) const { return values[i]; }
+        size_t size() const { return num; }
+    };
+    struct ScalarPairs {
+        const std::vector<std::pair<std::string, double>> *pairs;
+
+        const std::string &tag(size_t i) const { return (*pairs)[i].first; }
+        const InternedTag *interned(size_t) const { return nullptr; }
+        double value(size_t i) const { return (*pairs)[i].second; }
+        size_t size() const { return pairs->size(); }
+    };
+    struct InternedScalar {
+        const InternedTag *tag_;
+        double value_;
+
+        const std::string &tag(size_t) const { return tag_->tag; }
+        const InternedTag *interned(size_t) const { return tag_; }
+        double value(size_t) const { return value_; }
+        size_t size() const { return 1; }
+    };
+    // defined next to their only callers, in tensorboard_logger.cc and
+    // visualdl_logger.cc.
+    template <typename Scalars>
+    int log_scalars_tb(int64_t step, const Scalars &scalars);
+    template <typename Scalars>
+    int log_scalars(int64_t step, const Scalars &scalars, int64_t walltime);
+    // scalars skip the messages and encode the wire bytes directly, the
+    // result is byte-identical to serializing the messages.
+    template <typename Scalars>
+    int write_scalars_tb(int64_t step, const Scalars &scalars,
+                         double wall_time);
+    template <typename Scalars>
+    int write_scalars(int64_t step, const Scalars &scalars, int64_t walltime);
+    // `message` as field `field` of a value with a registered tag.
+    int write_value_tb(int64_t step, const InternedTag &tag, uint32_t field,
+                       const google::protobuf::MessageLite &message,
+                       double wall_time);
+    int write_value(int64_t step, const InternedTag &tag, int64_t walltime,
+                    uint32_t field,
+                    const google::protobuf::MessageLite &message);
+
+    // a `len` byte message is serialized in place to the pointer returned
+    // by `begin_*`, then `end_*` completes its frame (or adds it to the open
+    // batch) and applies the flush policy.  the staging lock is held across.
+    static const size_t kTFRecordOverhead =
+        sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    static char *begin_event(Staging &staging, size_t len);
+    int end_event(Staging &staging, size_t len);
+    char *begin_record(Staging &staging, size_t len);
+    int end_record(Staging &staging, size_t len, size_t num_values);
+
+    // one level of a message around a large bytes field: the fields of
+    // `head`, then field number `field` holding the next level, or the
+    // payload for the last level, then the fields of `tail` (if any), the
+    // ones numbered after `field` so they come out in protobuf's order.
+    struct NestedField {
+        const google::protobuf::MessageLite *head;
+        uint32_t field;
+        const google::protobuf::MessageLite *tail;
+    };
+    static const size_t kMaxNestedFields = 4;
+    // frames the message described by `levels` around `payload` as a
+    // TFRecord (`tfrecord`) or VisualDL record.  large payloads are written
+    // from where they are with writev(2) instead of being copied into the
+    // staging buffer.
+    int write_nested(const NestedField *levels, size_t num_levels,
+                     const char *payload, size_t payload_len, bool tfrecord);
+
+    // an open log file.  writers hold a reference for the duration of their
+    // write, so a rotation never closes it under a write in flight.
+    struct LogFile {
+        LogFile(int fd, const std::string &path) : fd(fd), path(path) {}
+        LogFile(const LogFile &) = delete;
+        LogFile &operator=(const LogFile &) = delete;
+        ~LogFile();
+
+        // opened with O_APPEND, so every write(2) of whole records lands
+        // atomically at the end of the file, whichever thread issues it.
+        const int fd;
+        const std::string path;
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> records{0};
+        // the repeated meta data record, if any, which alone does not make
+        // the file worth rotating.
+        uint64_t header_records = 0;
+        std::chrono::steady_clock::time_point opened;
+    };
+
+    // null if it can not be opened.
+    static std::shared_ptr<LogFile> open_log_file(const std::string &path);
+    // opens `path` for appending after its last complete record, the rest
+    // is truncated.
+    static std::shared_ptr<LogFile> resume_log_file(const std::string &path,
+                                                    bool tfrecord);
+    // length of the prefix of `data` made of complete, valid records,
+    // counted in `records`.
+    static size_t scan_log(const char *data, size_t size, bool tfrecord,
+                           uint64_t *records);
+    // `vdlrecords.<timestamp>.log<suffix>` in the log dir for VisualDL,
+    // `<log_file>.<timestamp>` for TensorBoard (`<log_file>` itself for a
+    // negative timestamp).
+    std::string log_file_name(int64_t timestamp) const;
+    // timestamp of the latest `log_file_name` that exists and is not empty,
+    // -1 if there is none.
+    int64_t latest_log_time() const;
+
+    // rotation: whether writing `bytes` more bytes holding `records`
+    // records to `file` needs a new file first.
+    bool needs_rotation(const LogFile &file, uint64_t bytes,
+                        uint64_t records) const;
+    // makes the pre-opened file current unless another writer already
+    // replaced `full`, returns the file to write to.
+    std::shared_ptr<LogFile> rotate(const std::shared_ptr<LogFile> &full);
+    // body of `preopen_`: drops the `retired` file (closing it if no write
+    // holds it anymore) and opens the one after the latest, as `next_file_`.
+    void preopen_next_file(std::shared_ptr<LogFile> retired);
+
+    // called after a record is appended to `staging.out`, writes the buffer
+    // out if the flush policy asks for it.
+    int commit_record(Staging &staging);
+    int flush_buffer(Staging &staging);
+    // writes all of `iov`, holding `records` whole records, to the current
+    // file (after rolling it over if due) and syncs as the flush policy asks.
+    int write_file(struct iovec *iov, int iovcnt, uint64_t records);
+    static int write_all(const LogFile &file, struct iovec *iov, int iovcnt);
+    // emits whatever the time based flush policy / record batching consider
+    // stale, used by the async writer thread when it wakes up on its own.
+    int flush_stale(Staging &staging);
+    std::chrono::milliseconds stale_check_period() const;
+
+    // fills in the length prefix of the open batch, which makes it a
+    // regular framed record in `staging.out`.
+    static void close_batch(Staging &staging);
 
     std::string log_dir_;
+    // what `log_file_name` is made of.
+    bool visualdl_ = false;
+    std::string suffix_;
+    std::string base_file_;
+    std::once_flag bucket_index_once_;
+    std::unique_ptr<const BucketIndex> bucket_index_;
+
+    uint64_t id_ = 0;
+    WallClock clock_;
+    // the file records go to, null once closed.  only accessed with
+    // std::atomic_load / std::atomic_store, as concurrent writers may race
+    // a rotation.
+    std::shared_ptr<LogFile> file_;
+
+    // rotation state, guarded by `rotation_mutex_`.  `preopen_` owns
+    // `next_file_` and `name_time_` while it runs.
+    RotationPolicy rotation_;
+    mutable std::mutex rotation_mutex_;
     std::string log_file_;
-    std::ofstream *ofs_;
-    std::vector<double> *bucket_limits_;
+    int64_t name_time_ = 0;
+    std::thread preopen_;
+    std::shared_ptr<LogFile> next_file_;
+    // VisualDL: the framed meta data record, repeated at the start of every
+    // new file so each one carries its display name.
+    std::string meta_record_;
+    FlushPolicy flush_policy_;
+    RecordBatching record_batching_;
+    Staging staging_;
+
+    bool concurrent_ = false;
+    std::mutex stagings_mutex_;
+    std::vector<std::unique_ptr<Staging>> stagings_;
+
+    // async mode, the writer thread is the only one touching `file_` and
+    // `staging_` while it is running, `file_mutex_` serializes it against
+    // `flush` and `close`.
+    std::thread writer_;
+    std::mutex queue_mutex_;
+    std::mutex file_mutex_;
+    std::condition_variable queue_not_empty_;
+    std::condition_variable queue_not_full_;
+    std::condition_variable queue_drained_;
+    std::deque<PendingWrite> pending_;
+    size_t max_pending_ = 0;
+    size_t writing_ = 0;
+    bool stop_writer_ = false;
+
+    HistogramParallelism histogram_parallelism_;
+    std::unique_ptr<WorkerPool> histogram_pool_;
+
+    // handed out by `register_tag`, never removed so handles stay valid.
+    std::mutex tags_mutex_;
+    std::map<std::string, std::unique_ptr<InternedTag>> tags_;
+
+    // one arena is enough for a synchronous logger, in async mode every
+    // queued message holds its own until the writer thread is done with it.
+    std::mutex arena_mutex_;
+    std::vector<google::protobuf::Arena *> arenas_;
+    std::vector<google::protobuf::Arena *> free_arenas_;
+    std::vector<std::unique_ptr<char[]>> arena_blocks_;
 };  // class TensorBoardLogger
 
+// a histogram of values that arrive in pieces (shards, micro batches) built
+// without gathering them: `update` any number of times, then `emit` writes a
+// single histogram.  only the totals are kept, O(bins) memory however many
+// values go in.  updates from several threads need outside locking.
+class HistogramAccumulator {
+   public:
+    // TensorBoard's default buckets.  emits what `add_histogram_tb` would
+    // write for all the values in one array, to the bit.
+    explicit HistogramAccumulator(TensorBoardLogger &logger);
+    // VisualDL, `bins` equal bins over [min, max] since the range of the
+    // data is not known up front.  values outside go to the first or last
+    // bin, NaN is left out.
+    HistogramAccumulator(TensorBoardLogger &logger, int bins, double min,
+                         double max);
+
+    template <typename T, typename Values = HistogramValues<T>>
+    void update(const T *values, size_t num) {
+        if (visualdl_) {
+            logger_.accumulate_bins<T, Values>(values, num, &bins_);
+        } else {
+            logger_.accumulate_histogram_tb<T, Values>(values, num,
+                                                       &buckets_);
+        }
+        num_ += num;
+    }
+    // halves by their bits, as `add_histogram_tb_fp16` takes them.
+    void update_fp16(const uint16_t *bits, size_t num) {
+        update<uint16_t, Float16Values>(bits, num);
+    }
+    void update_bf16(const uint16_t *bits, size_t num) {
+        update<uint16_t, BFloat16Values>(bits, num);
+    }
+
+    template <typename T>
+    void update(const std::vector<T> &values) {
+        update(values.data(), values.size());
+    }
+
+    // writes the histogram of everything since construction or `reset`,
+    // `walltime` is for VisualDL only.  the totals are kept, so a running
+    // histogram can be emitted at every step.
+    int emit(const std::string &tag, int step, time_t walltime = -1);
+    void reset();
+    uint64_t num() const { return num_; }
+
+   private:
+    TensorBoardLogger &logger_;
+    bool visualdl_;
+    BucketTotals buckets_;
+    BinTotals bins_;
+    uint64_t num_ = 0;
+};
+
+// PR and ROC curves of predictions that arrive in mini batches, without
+// keeping them: `update` any number of times, then emit either curve.  only
+// the weights per threshold bucket are kept, O(num_thresholds) memory.
+// accumulators of several threads can be merged into one.
+class CurveAccumulator {
+   public:
+    explicit CurveAccumulator(TensorBoardLogger &logger,
+                              int num_thresholds = 127);
+
+    // `weights` per prediction, 1 for all of them if null.
+    void update(const float *labels, const float *predictions, size_t num,
+                const float *weights = nullptr) {
+        totals_.add(labels, predictions, num, weights, 1.0);
+    }
+    void update(const double *labels, const double *predictions, size_t num,
+                const double *weights = nullptr) {
+        totals_.add(labels, predictions, num, weights, 1.0);
+    }
+    // both must have the same num_thresholds.
+    void merge(const CurveAccumulator &other) { totals_.merge(other.totals_); }
+
+    // the same counts as `add_pr_curve` / `add_roc_curve` over everything
+    // since construction or `reset`.
+    int emit_pr_curve(const std::string &tag, int step, time_t walltime = -1);
+    int emit_roc_curve(const std::string &tag, int step, time_t walltime = -1);
+    void reset() {
+        totals_ = CurveTotals(static_cast<int>(totals_.bins.size()));
+    }
+
+   private:
+    TensorBoardLogger &logger_;
+    CurveTotals totals_;
+};
+
 #endif  // TENSORBOARD_LOGGER_H
@@ -0,0 +1,192 @@
+#ifndef TENSORBOARD_LOGGER_WIRE_H
+#define TENSORBOARD_LOGGER_WIRE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// protobuf wire format primitives, for the few places that emit serialized
+// messages by hand instead of going through a generated message.
+// https://protobuf.dev/programming-guides/encoding/
+namespace wire {
+
+enum WireType {
+    kVarint = 0,
+    kFixed64 = 1,
+    kLengthDelimited = 2,
+    kFixed32 = 5,
+};
+
+// longest varint, a negative int64.
+const size_t kMaxVarintSize = 10;
+
+inline size_t varint_size(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+inline char *encode_varint(char *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = static_cast<char>(value);
+    return p;
+}
+
+inline uint32_t make_key(uint32_t field, WireType type) {
+    return (field << 3) | type;
+}
+
+inline size_t key_size(uint32_t field) { return varint_size(field << 3); }
+
+inline char *encode_key(char *p, uint32_t field, WireType type) {
+    return encode_varint(p, make_key(field, type));
+}
+
+// key and length prefix of a length-delimited field holding `len` bytes.
+inline size_t length_delimited_header_size(uint32_t field, size_t len) {
+    return key_size(field) + varint_size(len);
+}
+
+inline char *encode_length_delimited_header(char *p, uint32_t field,
+                                            size_t len) {
+    p = encode_key(p, field, kLengthDelimited);
+    return encode_varint(p, len);
+}
+
+// fixed width values are little endian on the wire, like the framing of
+// both log formats this assumes a little endian host.
+inline char *encode_fixed32(char *p, uint32_t value) {
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+inline char *encode_fixed64(char *p, uint64_t value) {
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+inline uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// whole fields, key included.  negative int64 values take 10 bytes, as
+// protobuf sign extends them.
+inline size_t int64_field_size(uint32_t field, int64_t value) {
+    return key_size(field) + varint_size(static_cast<uint64_t>(value));
+}
+
+inline char *encode_int64_field(char *p, uint32_t field, int64_t value) {
+    p = encode_key(p, field, kVarint);
+    return encode_varint(p, static_cast<uint64_t>(value));
+}
+
+inline size_t string_field_size(uint32_t field, const std::string &value) {
+    return length_delimited_header_size(field, value.size()) + value.size();
+}
+
+inline char *encode_string_field(char *p, uint32_t field,
+                                 const std::string &value) {
+    p = encode_length_delimited_header(p, field, value.size());
+    memcpy(p, value.data(), value.size());
+    return p + value.size();
+}
+
+inline size_t float_field_size(uint32_t field) {
+    return key_size(field) + sizeof(float);
+}
+
+inline char *encode_float_field(char *p, uint32_t field, float value) {
+    p = encode_key(p, field, kFixed32);
+    return encode_fixed32(p, float_bits(value));
+}
+
+inline size_t double_field_size(uint32_t field) {
+    return key_size(field) + sizeof(double);
+}
+
+inline char *encode_double_field(char *p, uint32_t field, double value) {
+    p = encode_key(p, field, kFixed64);
+    return encode_fixed64(p, double_bits(value));
+}
+
+// reads a varint from [p, end), null if it is cut off or too long.
+inline const char *decode_varint(const char *p, const char *end,
+                                 uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            *value = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// whether [p, end) is a well formed sequence of fields, without looking
+// into length-delimited ones.  if `nested_field` is non zero, that field
+// must be the only one and each occurrence must itself be well formed.
+inline bool valid_fields(const char *p, const char *end,
+                         uint32_t nested_field = 0) {
+    while (p < end) {
+        uint64_t key;
+        p = decode_varint(p, end, &key);
+        if (p == nullptr || (key >> 3) == 0 || (key >> 3) > 0x1fffffff) {
+            return false;
+        }
+        uint32_t field = static_cast<uint32_t>(key >> 3);
+        if (nested_field != 0 &&
+            (field != nested_field || (key & 7) != kLengthDelimited)) {
+            return false;
+        }
+        uint64_t len;
+        switch (key & 7) {
+            case kVarint:
+                p = decode_varint(p, end, &len);
+                if (p == nullptr) return false;
+                break;
+            case kFixed64:
+                if (end - p < 8) return false;
+                p += 8;
+                break;
+            case kFixed32:
+                if (end - p < 4) return false;
+                p += 4;
+                break;
+            case kLengthDelimited:
+                p = decode_varint(p, end, &len);
+                if (p == nullptr || len > static_cast<uint64_t>(end - p)) {
+                    return false;
+                }
+                if (nested_field != 0 && !valid_fields(p, p + len)) {
+                    return false;
+                }
+                p += len;
+                break;
+            default:
+                // groups are not used by either format.
+                return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace wire
+
+#endif  // TENSORBOARD_LOGGER_WIRE_H
@@ -0,0 +1,663 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BUCKET_INDEX_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+static int64_t segment_key(double magnitude) {
+    uint64_t bits;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    return static_cast<int64_t>(bits >> 48);
+}
+
+static double segment_start(int64_t key) {
+    uint64_t bits = static_cast<uint64_t>(key) << 48;
+    double start;
+    memcpy(&start, &bits, sizeof(start));
+    return start;
+}
+
+BucketIndex::BucketIndex(std::vector<double> limits)
+    : limits_(std::move(limits)) {
+    // ascending magnitudes of the non negative and the negative limits.
+    std::vector<double> magnitudes[2];
+    for (double limit : limits_) {
+        if (limit >= 0) {
+            magnitudes[0].push_back(limit);
+        } else {
+            magnitudes[1].push_back(-limit);
+        }
+    }
+    std::reverse(magnitudes[1].begin(), magnitudes[1].end());
+    exact_ = !limits_.empty() &&
+             limits_.size() <= std::numeric_limits<uint32_t>::max() &&
+             build(magnitudes);
+}
+
+bool BucketIndex::build(const std::vector<double> *magnitudes) {
+    // from the segment of the smallest magnitude to the one past the second
+    // largest, so the clamped last segment holds at most the largest.
+    bool empty = true;
+    int64_t first_key = std::numeric_limits<int64_t>::max();
+    int64_t last_key = std::numeric_limits<int64_t>::min();
+    for (int side = 0; side < 2; ++side) {
+        const auto &m = magnitudes[side];
+        if (m.empty()) continue;
+        empty = false;
+        first_key = std::min(first_key, segment_key(m.front()));
+        last_key = std::max(last_key, m.size() > 1
+                                          ? segment_key(m[m.size() - 2]) + 1
+                                          : segment_key(m.front()));
+    }
+    if (empty) {
+        return false;
+    }
+
+    first_key_ = first_key;
+    num_segments_ = last_key - first_key + 1;
+    segment_limits_.clear();
+    segment_buckets_.clear();
+    for (int side = 0; side < 2; ++side) {
+        const auto &m = magnitudes[side];
+        for (int64_t key = first_key; key <= last_key; ++key) {
+            size_t base =
+                std::lower_bound(m.begin(), m.end(), segment_start(key)) -
+                m.begin();
+            size_t end = key < last_key
+                             ? std::lower_bound(m.begin(), m.end(),
+                                                segment_start(key + 1)) -
+                                   m.begin()
+                             : m.size();
+            if (end - base > 1) {
+                return false;
+            }
+            // nothing compares greater than NaN, past the last limit of a
+            // sign the bucket is settled.
+            double limit = NAN;
+            if (base < m.size()) {
+                limit = side == 0 ? m[base] : std::nextafter(m[base], 0.0);
+            }
+            segment_limits_.push_back(limit);
+            segment_buckets_.push_back(static_cast<uint32_t>(
+                side == 0 ? magnitudes[1].size() + base : m.size() - base));
+        }
+    }
+    return true;
+}
+
+size_t BucketIndex::search(double value) const {
+    size_t index = std::lower_bound(limits_.begin(), limits_.end(), value) -
+                   limits_.begin();
+    return index < limits_.size() ? index : limits_.size() - 1;
+}
+
+#ifdef BUCKET_INDEX_HAVE_AVX2
+// the scalar `operator()` on 4 values, with gathers for the table lookups.
+struct BucketIndexAvx2 {
+    const double *segment_limits;
+    const uint32_t *segment_buckets;
+    int64_t first_key;
+    int64_t num_segments;
+    int64_t num_limits;
+};
+
+__attribute__((target("avx2"))) static inline __m256d load4_avx2(
+    const double *values) {
+    return _mm256_loadu_pd(values);
+}
+
+__attribute__((target("avx2"))) static inline __m256d load4_avx2(
+    const float *values) {
+    return _mm256_cvtps_pd(_mm_loadu_ps(values));
+}
+
+template <typename T>
+__attribute__((target("avx2"))) static void index_avx2(
+    const BucketIndexAvx2 &table, const T *values, size_t num,
+    uint32_t *buckets) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i magnitude_mask = _mm256_set1_epi64x(0x7fffffffffffffffLL);
+    const __m256i first_key = _mm256_set1_epi64x(table.first_key);
+    const __m256i num_segments = _mm256_set1_epi64x(table.num_segments);
+    const __m256i last_segment = _mm256_set1_epi64x(table.num_segments - 1);
+    const __m256i last_bucket = _mm256_set1_epi64x(table.num_limits - 1);
+    // the low halves of the 64 bit lanes.
+    const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    const auto *limits = reinterpret_cast<const long long *>(  // NOLINT
+        table.segment_limits);
+    const auto *bucket_table = reinterpret_cast<const int *>(
+        table.segment_buckets);
+
+    size_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        __m256d value = load4_avx2(values + i);
+        __m256i bits = _mm256_castpd_si256(value);
+        __m256i magnitude = _mm256_and_si256(bits, magnitude_mask);
+        __m256i segment = _mm256_sub_epi64(_mm256_srli_epi64(magnitude, 48),
+                                           first_key);
+        segment = _mm256_andnot_si256(_mm256_cmpgt_epi64(zero, segment),
+                                      segment);
+        segment = _mm256_blendv_epi8(
+            segment, last_segment,
+            _mm256_cmpgt_epi64(segment, last_segment));
+        __m256i negative = _mm256_srli_epi64(bits, 63);
+        // all ones for values >= 0.
+        __m256i positive = _mm256_sub_epi64(negative, one);
+        segment = _mm256_add_epi64(
+            segment, _mm256_andnot_si256(positive, num_segments));
+
+        __m256d limit = _mm256_castsi256_pd(
+            _mm256_i64gather_epi64(limits, segment, 8));
+        __m256i bucket = _mm256_cvtepu32_epi64(
+            _mm256_i64gather_epi32(bucket_table, segment, 4));
+        // all ones when past the limit, which steps one bucket up for
+        // positive values and one down for negative ones.
+        __m256i past = _mm256_castpd_si256(_mm256_cmp_pd(
+            limit, _mm256_castsi256_pd(magnitude), _CMP_LT_OQ));
+        __m256i step = _mm256_sub_epi64(_mm256_xor_si256(past, positive),
+                                        positive);
+        __m256i index = _mm256_add_epi64(bucket, step);
+        index = _mm256_blendv_epi8(index, last_bucket,
+                                   _mm256_cmpgt_epi64(index, last_bucket));
+        index = _mm256_and_si256(
+            index, _mm256_castpd_si256(_mm256_cmp_pd(value, value,
+                                                     _CMP_ORD_Q)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buckets + i),
+                         _mm256_castsi256_si128(
+                             _mm256_permutevar8x32_epi32(index, narrow)));
+    }
+}
+
+static bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+template <typename T>
+void BucketIndex::index_all(const T *values, size_t num,
+                            uint32_t *buckets) const {
+    size_t i = 0;
+#ifdef BUCKET_INDEX_HAVE_AVX2
+    static const bool avx2 = cpu_has_avx2();
+    if (avx2 && exact_) {
+        BucketIndexAvx2 table = {segment_limits_.data(),
+                                 segment_buckets_.data(), first_key_,
+                                 num_segments_,
+                                 static_cast<int64_t>(limits_.size())};
+        i = num - num % 4;
+        index_avx2(table, values, i, buckets);
+    }
+#endif
+    for (; i < num; ++i) {
+        buckets[i] = (*this)(static_cast<double>(values[i]));
+    }
+}
+
+void BucketIndex::operator()(const double *values, size_t num,
+                             uint32_t *buckets) const {
+    index_all(values, num, buckets);
+}
+
+void BucketIndex::operator()(const float *values, size_t num,
+                             uint32_t *buckets) const {
+    index_all(values, num, buckets);
+}
+
+template <typename T>
+static void finite_range_scalar(const T *values, size_t num, double *min,
+                                double *max) {
+    T lo = std::numeric_limits<T>::infinity();
+    T hi = -lo;
+    for (size_t i = 0; i < num; ++i) {
+        T v = values[i];
+        if (v - v == 0) {
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+    }
+    *min = lo;
+    *max = hi;
+}
+
+#ifdef BUCKET_INDEX_HAVE_AVX2
+// non finite lanes are replaced by +inf for the minimum and -inf for the
+// maximum, two accumulators each to hide the latency.
+__attribute__((target("avx2"))) static void finite_range_avx2(
+    const float *values, size_t num, double *min, double *max) {
+    const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    const __m256 neg_inf = _mm256_sub_ps(_mm256_setzero_ps(), inf);
+    const __m256 magnitude_mask =
+        _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 lo[2] = {inf, inf};
+    __m256 hi[2] = {neg_inf, neg_inf};
+    size_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        for (int k = 0; k < 2; ++k) {
+            __m256 v = _mm256_loadu_ps(values + i + 8 * k);
+            __m256 finite = _mm256_cmp_ps(_mm256_and_ps(v, magnitude_mask),
+                                          inf, _CMP_LT_OQ);
+            lo[k] = _mm256_min_ps(lo[k], _mm256_blendv_ps(inf, v, finite));
+            hi[k] = _mm256_max_ps(hi[k], _mm256_blendv_ps(neg_inf, v, finite));
+        }
+    }
+    float lanes[2][8];
+    _mm256_storeu_ps(lanes[0], _mm256_min_ps(lo[0], lo[1]));
+    _mm256_storeu_ps(lanes[1], _mm256_max_ps(hi[0], hi[1]));
+    double tail_lo, tail_hi;
+    finite_range_scalar(values + i, num - i, &tail_lo, &tail_hi);
+    for (int k = 0; k < 8; ++k) {
+        tail_lo = lanes[0][k] < tail_lo ? lanes[0][k] : tail_lo;
+        tail_hi = lanes[1][k] > tail_hi ? lanes[1][k] : tail_hi;
+    }
+    *min = tail_lo;
+    *max = tail_hi;
+}
+
+__attribute__((target("avx2"))) static void finite_range_avx2(
+    const double *values, size_t num, double *min, double *max) {
+    const __m256d inf =
+        _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    const __m256d neg_inf = _mm256_sub_pd(_mm256_setzero_pd(), inf);
+    const __m256d magnitude_mask =
+        _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    __m256d lo[2] = {inf, inf};
+    __m256d hi[2] = {neg_inf, neg_inf};
+    size_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        for (int k = 0; k < 2; ++k) {
+            __m256d v = _mm256_loadu_pd(values + i + 4 * k);
+            __m256d finite = _mm256_cmp_pd(_mm256_and_pd(v, magnitude_mask),
+                                           inf, _CMP_LT_OQ);
+            lo[k] = _mm256_min_pd(lo[k], _mm256_blendv_pd(inf, v, finite));
+            hi[k] = _mm256_max_pd(hi[k], _mm256_blendv_pd(neg_inf, v, finite));
+        }
+    }
+    double lanes[2][4];
+    _mm256_storeu_pd(lanes[0], _mm256_min_pd(lo[0], lo[1]));
+    _mm256_storeu_pd(lanes[1], _mm256_max_pd(hi[0], hi[1]));
+    double tail_lo, tail_hi;
+    finite_range_scalar(values + i, num - i, &tail_lo, &tail_hi);
+    for (int k = 0; k < 4; ++k) {
+        tail_lo = lanes[0][k] < tail_lo ? lanes[0][k] : tail_lo;
+        tail_hi = lanes[1][k] > tail_hi ? lanes[1][k] : tail_hi;
+    }
+    *min = tail_lo;
+    *max = tail_hi;
+}
+#endif
+
+#ifdef BUCKET_INDEX_HAVE_AVX2
+__attribute__((target("avx,f16c"))) static void to_float_f16c(
+    const uint16_t *bits, size_t num, float *out) {
+    for (size_t i = 0; i + 8 <= num; i += 8) {
+        __m128i half = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(bits + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(half));
+    }
+}
+
+__attribute__((target("avx2"))) static void to_float_avx2(
+    const uint16_t *bits, size_t num, float *out) {
+    for (size_t i = 0; i + 8 <= num; i += 8) {
+        __m128i half = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(bits + i));
+        __m256i wide = _mm256_slli_epi32(_mm256_cvtepu16_epi32(half), 16);
+        _mm256_storeu_ps(out + i, _mm256_castsi256_ps(wide));
+    }
+}
+
+static bool cpu_has_f16c() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+}
+#endif
+
+void to_float_fp16(const uint16_t *bits, size_t num, float *out) {
+    size_t i = 0;
+#ifdef BUCKET_INDEX_HAVE_AVX2
+    static const bool f16c = cpu_has_f16c();
+    if (f16c) {
+        i = num - num % 8;
+        to_float_f16c(bits, i, out);
+    }
+#endif
+    for (; i < num; ++i) {
+        out[i] = float16_value(bits[i]);
+    }
+}
+
+void to_float_bf16(const uint16_t *bits, size_t num, float *out) {
+    size_t i = 0;
+#ifdef BUCKET_INDEX_HAVE_AVX2
+    static const bool avx2 = cpu_has_avx2();
+    if (avx2) {
+        i = num - num % 8;
+        to_float_avx2(bits, i, out);
+    }
+#endif
+    for (; i < num; ++i) {
+        out[i] = bfloat16_value(bits[i]);
+    }
+}
+
+template <typename T>
+static void finite_range_all(const T *values, size_t num, double *min,
+                             double *max) {
+#ifdef BUCKET_INDEX_HAVE_AVX2
+    static const bool avx2 = cpu_has_avx2();
+    if (avx2) {
+        finite_range_avx2(values, num, min, max);
+        return;
+    }
+#endif
+    finite_range_scalar(values, num, min, max);
+}
+
+void finite_range(const float *values, size_t num, double *min,
+                  double *max) {
+    finite_range_all(values, num, min, max);
+}
+
+void finite_range(const double *values, size_t num, double *min,
+                  double *max) {
+    finite_range_all(values, num, min, max);
+}
+
+// a chunk of floats at a time.
+static void finite_range_converted(void (*convert)(const uint16_t *, size_t,
+                                                   float *),
+                                   const uint16_t *bits, size_t num,
+                                   double *min, double *max) {
+    const size_t kChunk = 1024;
+    float buffer[kChunk];
+    double lo = std::numeric_limits<double>::infinity();
+    double hi = -lo;
+    for (size_t start = 0; start < num; start += kChunk) {
+        size_t chunk = std::min(kChunk, num - start);
+        convert(bits + start, chunk, buffer);
+        double chunk_lo, chunk_hi;
+        finite_range_all(buffer, chunk, &chunk_lo, &chunk_hi);
+        lo = chunk_lo < lo ? chunk_lo : lo;
+        hi = chunk_hi > hi ? chunk_hi : hi;
+    }
+    *min = lo;
+    *max = hi;
+}
+
+void finite_range_fp16(const uint16_t *bits, size_t num, double *min,
+                       double *max) {
+    finite_range_converted(to_float_fp16, bits, num, min, max);
+}
+
+void finite_range_bf16(const uint16_t *bits, size_t num, double *min,
+                       double *max) {
+    finite_range_converted(to_float_bf16, bits, num, min, max);
+}
+
+// every byte is finite, plain integer loops vectorize well.
+template <typename T>
+static void finite_range_bytes(const T *values, size_t num, double *min,
+                               double *max) {
+    if (num == 0) {
+        *min = std::numeric_limits<double>::infinity();
+        *max = -*min;
+        return;
+    }
+    T lo = values[0];
+    T hi = values[0];
+    for (size_t i = 1; i < num; ++i) {
+        lo = values[i] < lo ? values[i] : lo;
+        hi = values[i] > hi ? values[i] : hi;
+    }
+    *min = lo;
+    *max = hi;
+}
+
+void finite_range(const int8_t *values, size_t num, double *min,
+                  double *max) {
+    finite_range_bytes(values, num, min, max);
+}
+
+void finite_range(const uint8_t *values, size_t num, double *min,
+                  double *max) {
+    finite_range_bytes(values, num, min, max);
+}
+
+WorkerPool::WorkerPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+        threads_.emplace_back(&WorkerPool::work, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) thread.join();
+}
+
+void WorkerPool::run(size_t num_tasks,
+                     const std::function<void(size_t)> &task) {
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    num_tasks_ = num_tasks;
+    next_task_ = 0;
+    unfinished_ = num_tasks;
+    loop_++;
+    wake_.notify_all();
+    run_tasks(lock);
+    done_.wait(lock, [this] { return unfinished_ == 0; });
+    task_ = nullptr;
+}
+
+void WorkerPool::work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t seen = loop_;
+    while (true) {
+        wake_.wait(lock, [this, seen] { return stop_ || loop_ != seen; });
+        if (stop_) {
+            return;
+        }
+        seen = loop_;
+        run_tasks(lock);
+    }
+}
+
+void WorkerPool::run_tasks(std::unique_lock<std::mutex> &lock) {
+    while (next_task_ < num_tasks_) {
+        size_t task = next_task_++;
+        const auto &fn = *task_;
+        lock.unlock();
+        fn(task);
+        lock.lock();
+        if (--unfinished_ == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+std::vector<size_t> sample_indices(size_t num,
+                                   const HistogramSampling &sampling) {
+    size_t max_values = sampling.max_values;
+    if (max_values == 0) {
+        throw std::invalid_argument("max_values must be positive");
+    }
+    std::vector<size_t> indices;
+    if (max_values >= num) {
+        indices.resize(num);
+        std::iota(indices.begin(), indices.end(), 0);
+        return indices;
+    }
+
+    std::mt19937_64 random(sampling.seed);
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    // in (0, 1], so its log is finite.
+    auto uniform = [&] { return 1.0 - distribution(random); };
+    indices.reserve(max_values);
+    if (sampling.method == HistogramSampling::kStride) {
+        double stride = static_cast<double>(num) / max_values;
+        double offset = (1.0 - uniform()) * stride;
+        for (size_t i = 0; i < max_values; ++i) {
+            size_t index = static_cast<size_t>(offset + i * stride);
+            indices.push_back(std::min(index, num - 1));
+        }
+        return indices;
+    }
+
+    // Algorithm L (Li, 1994) skips ahead geometrically instead of drawing a
+    // random number for every value.
+    std::uniform_int_distribution<size_t> slot(0, max_values - 1);
+    for (size_t i = 0; i < max_values; ++i) {
+        indices.push_back(i);
+    }
+    double w = std::exp(std::log(uniform()) / max_values);
+    size_t i = max_values - 1;
+    while (true) {
+        double skip = std::floor(std::log(uniform()) / std::log1p(-w));
+        if (!(skip < static_cast<double>(num - 1 - i))) {
+            break;
+        }
+        i += static_cast<size_t>(skip) + 1;
+        indices[slot(random)] = i;
+        w *= std::exp(std::log(uniform()) / max_values);
+    }
+    std::sort(indices.begin(), indices.end());
+    return indices;
+}
+
+DDSketch::DDSketch(double relative_accuracy, size_t max_bins)
+    : relative_accuracy_(relative_accuracy), max_bins_(max_bins) {
+    if (!(relative_accuracy > 0 && relative_accuracy < 1) || max_bins < 1) {
+        throw std::invalid_argument(
+            "sketch accuracy must be in (0, 1) with at least one bin");
+    }
+    log_gamma_ = std::log((1 + relative_accuracy) / (1 - relative_accuracy));
+}
+
+void DDSketch::Store::add(int64_t key, uint64_t count, size_t max_bins) {
+    if (counts.empty()) {
+        offset = key;
+        counts.assign(1, 0);
+    }
+    int64_t last = offset + static_cast<int64_t>(counts.size()) - 1;
+    if (key > last) {
+        int64_t new_offset =
+            std::max(offset, key - static_cast<int64_t>(max_bins) + 1);
+        if (new_offset > offset) {
+            // the smallest magnitudes go into the new lowest bucket.
+            std::vector<uint64_t> moved(key - new_offset + 1, 0);
+            for (size_t i = 0; i < counts.size(); ++i) {
+                int64_t k = std::max(offset + static_cast<int64_t>(i),
+                                     new_offset);
+                moved[k - new_offset] += counts[i];
+            }
+            counts.swap(moved);
+            offset = new_offset;
+        } else {
+            counts.resize(key - offset + 1, 0);
+        }
+    } else if (key < offset) {
+        key = std::max(key, last - static_cast<int64_t>(max_bins) + 1);
+        if (key < offset) {
+            counts.insert(counts.begin(), offset - key, 0);
+            offset = key;
+        }
+    }
+    counts[key - offset] += count;
+    total += count;
+}
+
+void DDSketch::add(double value) {
+    num_++;
+    if (!(value - value == 0)) {
+        return;
+    }
+    sum_ += value;
+    sum_squares_ += value * value;
+    min_ = value < min_ ? value : min_;
+    max_ = value > max_ ? value : max_;
+    if (value > 0) {
+        positive_.add(key(value), 1, max_bins_);
+    } else if (value < 0) {
+        negative_.add(key(-value), 1, max_bins_);
+    } else {
+        zeros_++;
+    }
+}
+
+void DDSketch::merge(const DDSketch &other) {
+    if (other.log_gamma_ != log_gamma_) {
+        throw std::invalid_argument("sketches of different accuracy");
+    }
+    const Store *from[2] = {&other.positive_, &other.negative_};
+    Store *to[2] = {&positive_, &negative_};
+    for (int side = 0; side < 2; ++side) {
+        const auto &counts = from[side]->counts;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            if (counts[i] > 0) {
+                to[side]->add(from[side]->offset + static_cast<int64_t>(i),
+                              counts[i], max_bins_);
+            }
+        }
+    }
+    zeros_ += other.zeros_;
+    num_ += other.num_;
+    sum_ += other.sum_;
+    sum_squares_ += other.sum_squares_;
+    min_ = other.min_ < min_ ? other.min_ : min_;
+    max_ = other.max_ > max_ ? other.max_ : max_;
+}
+
+std::vector<DDSketch::Bucket> DDSketch::buckets() const {
+    std::vector<Bucket> buckets;
+    for (size_t i = negative_.counts.size(); i-- > 0;) {
+        int64_t k = negative_.offset + static_cast<int64_t>(i);
+        if (negative_.counts[i] > 0) {
+            buckets.push_back({-bound(k), -bound(k - 1), negative_.counts[i]});
+        }
+    }
+    if (zeros_ > 0) {
+        buckets.push_back({0.0, 0.0, zeros_});
+    }
+    for (size_t i = 0; i < positive_.counts.size(); ++i) {
+        int64_t k = positive_.offset + static_cast<int64_t>(i);
+        if (positive_.counts[i] > 0) {
+            buckets.push_back({bound(k - 1), bound(k), positive_.counts[i]});
+        }
+    }
+    return buckets;
+}
+
+double DDSketch::quantile(double q) const {
+    if (count() == 0) {
+        return NAN;
+    }
+    // the value a bucket stands for is within the relative accuracy of
+    // both of its bounds.
+    double scale = 2 / (1 + std::exp(log_gamma_));
+    double rank = q * (count() - 1);
+    double value = max_;
+    uint64_t seen = 0;
+    for (const auto &bucket : buckets()) {
+        seen += bucket.count;
+        if (seen > rank) {
+            value = bucket.upper > 0 ? bucket.upper * scale
+                                     : bucket.lower * scale;
+            break;
+        }
+    }
+    return std::min(std::max(value, min_), max_);
+}
@@ -1,9 +1,24 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 
 #include "web_logger.h"
+#include "wire.h"
 
 using std::cerr;
 using std::endl;
@@ -11,6 +26,13 @@ using std::ifstream;
 using std::ostringstream;
 using std::string;
 
+// big enough for scalars, text and meta records.
+const size_t kArenaInitialBlockSize = 8192;
+
+// smaller payloads of `write_nested` are copied into the staging buffer like
+// any other record, so they still follow the flush policy.
+const size_t kZeroCopyMinBytes = 64 << 10;
+
 string read_binary_file(const string &filename) {
     ostringstream ss;
     ifstream fin(filename, std::ios::binary);
@@ -23,6 +45,33 @@ string read_binary_file(const string &filename) {
     return ss.str();
 }
 
+MappedFile::MappedFile(const string &filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        void *mapping =
+            mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            mapping_ = mapping;
+            mapping_size_ = st.st_size;
+            data_ = static_cast<const char *>(mapping);
+            size_ = mapping_size_;
+        }
+    }
+    if (fd >= 0) ::close(fd);
+    if (mapping_ == nullptr) {
+        fallback_ = read_binary_file(filename);
+        data_ = fallback_.data();
+        size_ = fallback_.size();
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (mapping_ != nullptr) munmap(mapping_, mapping_size_);
+}
+
 string get_parent_dir(const string &path) {
     auto last_slash_pos = path.find_last_of("/\\");
     if (last_slash_pos == string::npos) {
@@ -30,3 +79,738 @@ string get_parent_dir(const string &path) {
     }
     return path.substr(0, last_slash_pos + 1);
 }
+
+void OutputBuffer::clear() {
+    size_ = 0;
+    if (capacity_ > kMaxBufferedBytes) {
+        delete[] data_;
+        data_ = nullptr;
+        capacity_ = 0;
+    }
+}
+
+void OutputBuffer::grow(size_t min_capacity) {
+    size_t capacity = std::max<size_t>(capacity_ * 2, 4096);
+    while (capacity < min_capacity) capacity *= 2;
+    char *data = new char[capacity];
+    if (size_ > 0) memcpy(data, data_, size_);
+    delete[] data_;
+    data_ = data;
+    capacity_ = capacity;
+}
+
+// the initial block is owned by the caller, so it survives `Reset` and small
+// messages (scalars, text, meta) never hit the allocator once warm.
+static google::protobuf::Arena *create_arena(char *initial_block) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = initial_block;
+    options.initial_block_size = kArenaInitialBlockSize;
+    return new google::protobuf::Arena(options);
+}
+
+WallClock::WallClock(Source source) {
+#ifdef CLOCK_REALTIME_COARSE
+    clock_id_ = source == kCoarse ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME;
+#else
+    clock_id_ = CLOCK_REALTIME;
+#endif
+}
+
+int64_t WallClock::micros() const {
+    struct timespec ts;
+    clock_gettime(clock_id_, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t TensorBoardLogger::next_logger_id() {
+    static std::atomic<uint64_t> next_id(1);
+    return next_id++;
+}
+
+TensorBoardLogger::Staging &TensorBoardLogger::current_staging() {
+    if (!concurrent_) {
+        return staging_;
+    }
+    // keyed by logger id rather than address, so a stale entry of a
+    // destroyed logger can never be picked up by a new one.
+    thread_local uint64_t cached_id = 0;
+    thread_local Staging *cached = nullptr;
+    if (cached_id == id_) {
+        return *cached;
+    }
+    thread_local std::unordered_map<uint64_t, Staging *> stagings;
+    auto &staging = stagings[id_];
+    if (staging == nullptr) {
+        std::lock_guard<std::mutex> lock(stagings_mutex_);
+        stagings_.emplace_back(new Staging());
+        staging = stagings_.back().get();
+        staging->last_flush = std::chrono::steady_clock::now();
+    }
+    cached_id = id_;
+    cached = staging;
+    return *staging;
+}
+
+size_t TensorBoardLogger::histogram_tasks(size_t num) const {
+    const auto &parallelism = histogram_parallelism_;
+    if (parallelism.threads <= 1 || num < parallelism.min_values) {
+        return 1;
+    }
+    size_t num_blocks = (num + kHistogramBlock - 1) / kHistogramBlock;
+    return std::max<size_t>(1, std::min(parallelism.threads, num_blocks));
+}
+
+void TensorBoardLogger::run_histogram_tasks(
+    size_t num_tasks, const std::function<void(size_t)> &task) {
+    if (num_tasks == 1) {
+        task(0);
+    } else if (histogram_parallelism_.executor) {
+        histogram_parallelism_.executor(num_tasks, task);
+    } else {
+        histogram_pool_->run(num_tasks, task);
+    }
+}
+
+TagHandle TensorBoardLogger::register_tag(const string &tag) {
+    std::lock_guard<std::mutex> lock(tags_mutex_);
+    auto &interned = tags_[tag];
+    if (interned == nullptr) {
+        interned.reset(new InternedTag());
+        interned->tag = tag;
+        if (!tag.empty()) {
+            char buf[wire::kMaxVarintSize * 2];
+            uint32_t field = visualdl::Record_Value::kTagFieldNumber;
+            char *end = wire::encode_length_delimited_header(buf, field,
+                                                             tag.size());
+            interned->vdl_field.assign(buf, end);
+            interned->vdl_field += tag;
+
+            field = Summary::Value::kTagFieldNumber;
+            end = wire::encode_length_delimited_header(buf, field, tag.size());
+            interned->tb_field.assign(buf, end);
+            interned->tb_field += tag;
+        }
+    }
+    return TagHandle(interned.get());
+}
+
+google::protobuf::Arena *TensorBoardLogger::acquire_arena() {
+    if (concurrent_) {
+        // messages are written on the thread that built them, one arena per
+        // thread is enough.
+        auto &staging = current_staging();
+        if (staging.arena == nullptr) {
+            staging.arena_block.reset(new char[kArenaInitialBlockSize]);
+            staging.arena = create_arena(staging.arena_block.get());
+        }
+        return staging.arena;
+    }
+
+    std::lock_guard<std::mutex> lock(arena_mutex_);
+    if (!free_arenas_.empty()) {
+        auto *arena = free_arenas_.back();
+        free_arenas_.pop_back();
+        return arena;
+    }
+    arena_blocks_.emplace_back(new char[kArenaInitialBlockSize]);
+    arenas_.push_back(create_arena(arena_blocks_.back().get()));
+    return arenas_.back();
+}
+
+void TensorBoardLogger::release_message(
+    google::protobuf::MessageLite *message) {
+    auto *arena = message->GetArena();
+    if (arena == nullptr) {
+        delete message;
+        return;
+    }
+    arena->Reset();
+    if (concurrent_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(arena_mutex_);
+    free_arenas_.push_back(arena);
+}
+
+int TensorBoardLogger::enqueue(PendingWrite &&pending) {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    queue_not_full_.wait(lock, [this] {
+        return stop_writer_ || pending_.size() < max_pending_;
+    });
+    if (stop_writer_) {
+        // logger closed, the record is dropped.
+        lock.unlock();
+        if (pending.event) release_message(pending.event);
+        if (pending.record) release_message(pending.record);
+        return -1;
+    }
+    pending_.push_back(pending);
+    lock.unlock();
+    queue_not_empty_.notify_one();
+    return 0;
+}
+
+void TensorBoardLogger::writer_loop() {
+    std::deque<PendingWrite> batch;
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    auto has_work = [this] { return stop_writer_ || !pending_.empty(); };
+    auto period = stale_check_period();
+    while (true) {
+        if (period.count() > 0) {
+            // wake up on our own so buffered records do not go stale while
+            // the producers are quiet.
+            if (!queue_not_empty_.wait_for(lock, period, has_work)) {
+                lock.unlock();
+                {
+                    std::lock_guard<std::mutex> file_lock(file_mutex_);
+                    flush_stale(staging_);
+                }
+                lock.lock();
+                continue;
+            }
+        } else {
+            queue_not_empty_.wait(lock, has_work);
+        }
+        if (pending_.empty()) {
+            // stop requested and everything is written.
+            break;
+        }
+        // take the whole queue at once, so producers only contend with the
+        // writer once per batch instead of once per record.
+        batch.swap(pending_);
+        writing_ = batch.size();
+        lock.unlock();
+        queue_not_full_.notify_all();
+
+        {
+            std::lock_guard<std::mutex> file_lock(file_mutex_);
+            for (auto &pending : batch) {
+                if (pending.event) {
+                    write(*pending.event);
+                    release_message(pending.event);
+                } else {
+                    write(*pending.record);
+                    release_message(pending.record);
+                }
+            }
+        }
+        batch.clear();
+
+        lock.lock();
+        writing_ = 0;
+        if (pending_.empty()) {
+            queue_drained_.notify_all();
+        }
+    }
+    writing_ = 0;
+    queue_drained_.notify_all();
+}
+
+int TensorBoardLogger::flush() {
+    if (writer_.joinable()) {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        queue_drained_.wait(
+            lock, [this] { return pending_.empty() && writing_ == 0; });
+    }
+    std::lock_guard<std::mutex> file_lock(file_mutex_);
+    int ret = flush_buffer(staging_);
+    if (concurrent_) {
+        std::lock_guard<std::mutex> lock(stagings_mutex_);
+        for (auto &staging : stagings_) {
+            std::lock_guard<std::mutex> staging_lock(staging->mutex);
+            if (flush_buffer(*staging) != 0) ret = -1;
+        }
+    }
+    return ret;
+}
+
+int TensorBoardLogger::close() {
+    if (writer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            stop_writer_ = true;
+        }
+        queue_not_empty_.notify_one();
+        queue_not_full_.notify_all();
+        writer_.join();
+    }
+    if (std::atomic_load(&file_) == nullptr) {
+        return 0;
+    }
+    int ret = flush();
+    std::lock_guard<std::mutex> file_lock(file_mutex_);
+    std::lock_guard<std::mutex> lock(rotation_mutex_);
+    if (preopen_.joinable()) {
+        preopen_.join();
+    }
+    if (next_file_ != nullptr) {
+        // never written to.
+        unlink(next_file_->path.c_str());
+        next_file_.reset();
+    }
+    std::atomic_store(&file_, std::shared_ptr<LogFile>());
+    return ret;
+}
+
+TensorBoardLogger::LogFile::~LogFile() { ::close(fd); }
+
+std::string TensorBoardLogger::log_file() const {
+    std::lock_guard<std::mutex> lock(rotation_mutex_);
+    return log_file_;
+}
+
+std::shared_ptr<TensorBoardLogger::LogFile> TensorBoardLogger::open_log_file(
+    const std::string &path) {
+    int fd = ::open(path.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    return std::make_shared<LogFile>(fd, path);
+}
+
+std::shared_ptr<TensorBoardLogger::LogFile>
+TensorBoardLogger::resume_log_file(const std::string &path, bool tfrecord) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto log = std::make_shared<LogFile>(fd, path);
+    size_t size;
+    size_t valid;
+    uint64_t records;
+    {
+        MappedFile file(path);
+        size = file.size();
+        valid = scan_log(file.data(), size, tfrecord, &records);
+    }
+    if (valid < size) {
+        cerr << "truncating " << size - valid << " bytes of torn records at "
+             << "the end of " << path << endl;
+        if (ftruncate(fd, valid) != 0) {
+            return nullptr;
+        }
+    }
+    // what is already there counts towards rotation.
+    log->bytes = valid;
+    log->records = records;
+    return log;
+}
+
+size_t TensorBoardLogger::scan_log(const char *data, size_t size,
+                                   bool tfrecord, uint64_t *records) {
+    const size_t prefix_len =
+        sizeof(uint64_t) + (tfrecord ? sizeof(uint32_t) : 0);
+    const size_t trailer_len = tfrecord ? sizeof(uint32_t) : 0;
+    size_t offset = 0;
+    *records = 0;
+    while (size - offset >= prefix_len) {
+        const char *frame = data + offset;
+        uint64_t len;
+        memcpy(&len, frame, sizeof(len));
+        if (len > size - offset - prefix_len ||
+            trailer_len > size - offset - prefix_len - len) {
+            break;
+        }
+        const char *payload = frame + prefix_len;
+        if (tfrecord) {
+            uint32_t len_crc, data_crc;
+            memcpy(&len_crc, frame + sizeof(len), sizeof(len_crc));
+            memcpy(&data_crc, payload + len, sizeof(data_crc));
+            if (len_crc != masked_crc32c(frame, sizeof(len)) ||
+                data_crc != masked_crc32c(payload, len)) {
+                break;
+            }
+        } else if (!wire::valid_fields(payload, payload + len,
+                                       Record::kValuesFieldNumber)) {
+            // a structural parse of the record and its values, without
+            // materializing them.  an empty record is valid protobuf, so a
+            // zero length is a record like any other.
+            break;
+        }
+        offset += prefix_len + len + trailer_len;
+        ++*records;
+    }
+    return offset;
+}
+
+std::string TensorBoardLogger::log_file_name(int64_t timestamp) const {
+    if (!visualdl_ && timestamp < 0) {
+        return base_file_;
+    }
+    std::ostringstream time_str;
+    time_str << std::setw(10) << std::setfill('0') << timestamp;
+    if (visualdl_) {
+        return log_dir_ + "/vdlrecords." + time_str.str() + ".log" + suffix_;
+    }
+    return base_file_ + "." + time_str.str();
+}
+
+int64_t TensorBoardLogger::latest_log_time() const {
+    string dir;
+    string prefix;
+    string ending;
+    if (visualdl_) {
+        dir = log_dir_;
+        prefix = "vdlrecords.";
+        ending = ".log" + suffix_;
+    } else {
+        dir = get_parent_dir(base_file_);
+        auto last_slash_pos = base_file_.find_last_of("/\\");
+        prefix = base_file_.substr(
+                     last_slash_pos == string::npos ? 0 : last_slash_pos + 1) +
+                 ".";
+    }
+    int64_t latest = -1;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return latest;
+    }
+    while (struct dirent *entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name.size() <= prefix.size() + ending.size() ||
+            name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - ending.size(), ending.size(),
+                         ending) != 0) {
+            continue;
+        }
+        auto digits = name.substr(
+            prefix.size(), name.size() - prefix.size() - ending.size());
+        if (digits.size() > 18 ||
+            digits.find_first_not_of("0123456789") != string::npos) {
+            continue;
+        }
+        // a file pre-opened for rotation and never written to, left behind
+        // by a crash, holds nothing to resume.
+        struct stat st;
+        if (stat((dir + "/" + name).c_str(), &st) != 0 || st.st_size == 0) {
+            continue;
+        }
+        latest = std::max<int64_t>(latest, std::stoll(digits));
+    }
+    closedir(d);
+    return latest;
+}
+
+int TensorBoardLogger::commit_record(Staging &staging) {
+    bool flush = false;
+    switch (flush_policy_.mode) {
+        case FlushPolicy::kEveryRecord:
+            flush = true;
+            break;
+        case FlushPolicy::kEveryBytes:
+            flush = staging.out.size() >= flush_policy_.bytes;
+            break;
+        case FlushPolicy::kEveryMillis:
+            flush = std::chrono::steady_clock::now() - staging.last_flush >=
+                    std::chrono::milliseconds(flush_policy_.millis);
+            break;
+        case FlushPolicy::kExplicit:
+            break;
+    }
+    if (flush || staging.out.size() >= kMaxBufferedBytes) {
+        return flush_buffer(staging);
+    }
+    return 0;
+}
+
+std::chrono::milliseconds TensorBoardLogger::stale_check_period() const {
+    int64_t period = 0;
+    if (flush_policy_.mode == FlushPolicy::kEveryMillis) {
+        period = flush_policy_.millis;
+    }
+    if (record_batching_.max_millis > 0 &&
+        (period == 0 || record_batching_.max_millis < period)) {
+        period = record_batching_.max_millis;
+    }
+    return std::chrono::milliseconds(period);
+}
+
+int TensorBoardLogger::flush_stale(Staging &staging) {
+    auto now = std::chrono::steady_clock::now();
+    if (staging.batch_open && record_batching_.max_millis > 0 &&
+        now - staging.batch_opened >=
+            std::chrono::milliseconds(record_batching_.max_millis)) {
+        close_batch(staging);
+        return commit_record(staging);
+    }
+    if (flush_policy_.mode == FlushPolicy::kEveryMillis &&
+        !staging.out.empty() &&
+        now - staging.last_flush >=
+            std::chrono::milliseconds(flush_policy_.millis)) {
+        return flush_buffer(staging);
+    }
+    return 0;
+}
+
+int TensorBoardLogger::flush_buffer(Staging &staging) {
+    close_batch(staging);
+    auto &out = staging.out;
+    // one write(2) for the whole buffer keeps the records of this staging
+    // buffer contiguous in the file even with other threads appending.
+    struct iovec iov;
+    iov.iov_base = out.data();
+    iov.iov_len = out.size();
+    int ret = write_file(&iov, 1, staging.records);
+    out.clear();
+    staging.records = 0;
+    if (ret == 0) {
+        staging.last_flush = std::chrono::steady_clock::now();
+    }
+    return ret;
+}
+
+int TensorBoardLogger::write_file(struct iovec *iov, int iovcnt,
+                                  uint64_t records) {
+    auto file = std::atomic_load(&file_);
+    if (file == nullptr) {
+        return -1;
+    }
+    uint64_t bytes = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        bytes += iov[i].iov_len;
+    }
+    if (bytes > 0 && rotation_.enabled() &&
+        needs_rotation(*file, bytes, records)) {
+        file = rotate(file);
+        if (file == nullptr) {
+            return -1;
+        }
+    }
+    if (write_all(*file, iov, iovcnt) != 0) {
+        return -1;
+    }
+    file->bytes += bytes;
+    file->records += records;
+
+    int synced = 0;
+    switch (flush_policy_.durability) {
+        case FlushPolicy::kNoSync:
+            break;
+        case FlushPolicy::kFdatasync:
+            synced = ::fdatasync(file->fd);
+            break;
+        case FlushPolicy::kFsync:
+            synced = ::fsync(file->fd);
+            break;
+    }
+    if (synced != 0) {
+        cerr << "failed to sync log file " << file->path << endl;
+        return -1;
+    }
+    return 0;
+}
+
+int TensorBoardLogger::write_all(const LogFile &file, struct iovec *iov,
+                                 int iovcnt) {
+    while (true) {
+        while (iovcnt > 0 && iov->iov_len == 0) {
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt <= 0) {
+            break;
+        }
+        ssize_t n = ::writev(file.fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            cerr << "failed to write log file " << file.path << endl;
+            return -1;
+        }
+        // a short write resumes in the middle of an iovec.
+        while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+bool TensorBoardLogger::needs_rotation(const LogFile &file, uint64_t bytes,
+                                       uint64_t records) const {
+    uint64_t file_records = file.records;
+    if (file_records <= file.header_records) {
+        // nothing but the meta data record yet, a new file would not fare
+        // any better.
+        return false;
+    }
+    const auto &limits = rotation_;
+    return (limits.max_bytes > 0 && file.bytes + bytes > limits.max_bytes) ||
+           (limits.max_records > 0 &&
+            file_records + records > limits.max_records) ||
+           (limits.max_millis > 0 &&
+            std::chrono::steady_clock::now() - file.opened >=
+                std::chrono::milliseconds(limits.max_millis));
+}
+
+std::shared_ptr<TensorBoardLogger::LogFile> TensorBoardLogger::rotate(
+    const std::shared_ptr<LogFile> &full) {
+    std::lock_guard<std::mutex> lock(rotation_mutex_);
+    auto current = std::atomic_load(&file_);
+    if (current != full) {
+        // another writer rolled over first (or the logger is closed).
+        return current;
+    }
+    if (preopen_.joinable()) {
+        preopen_.join();
+    }
+    if (next_file_ == nullptr) {
+        // the background open failed, try once more before giving up and
+        // staying with the full file.
+        preopen_next_file(nullptr);
+        if (next_file_ == nullptr) {
+            return current;
+        }
+    }
+    auto next = std::move(next_file_);
+    next_file_.reset();
+    if (!meta_record_.empty()) {
+        struct iovec iov;
+        iov.iov_base = &meta_record_[0];
+        iov.iov_len = meta_record_.size();
+        if (write_all(*next, &iov, 1) == 0) {
+            next->bytes = meta_record_.size();
+            next->records = 1;
+            next->header_records = 1;
+        }
+    }
+    next->opened = std::chrono::steady_clock::now();
+    log_file_ = next->path;
+    std::atomic_store(&file_, next);
+    // the full file is closed off the hot path too, unless a concurrent
+    // write still holds it.
+    preopen_ = std::thread(&TensorBoardLogger::preopen_next_file, this,
+                           std::move(current));
+    return next;
+}
+
+void TensorBoardLogger::preopen_next_file(std::shared_ptr<LogFile> retired) {
+    retired.reset();
+    // O_EXCL, so a name taken by someone else is skipped instead of
+    // truncated.
+    int64_t timestamp = std::max<int64_t>(time(nullptr), name_time_ + 1);
+    string path;
+    for (int attempt = 0; attempt < 1000; ++attempt, ++timestamp) {
+        path = log_file_name(timestamp);
+        int fd = ::open(path.c_str(),
+                        O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                        0644);
+        if (fd >= 0) {
+            name_time_ = timestamp;
+            next_file_ = std::make_shared<LogFile>(fd, path);
+            return;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+    cerr << "failed to open the next log file " << path << endl;
+}
+
+int TensorBoardLogger::write_nested(const NestedField *levels,
+                                    size_t num_levels, const char *payload,
+                                    size_t payload_len, bool tfrecord) {
+    assert(num_levels > 0 && num_levels <= kMaxNestedFields);
+    // serialized size of every level, innermost first.  the heads go before
+    // the payload, the tails after it, innermost first.
+    size_t body_len[kMaxNestedFields];
+    size_t inner_len = payload_len;
+    size_t tail_len = 0;
+    for (size_t i = num_levels; i-- > 0;) {
+        size_t level_tail_len =
+            levels[i].tail != nullptr ? levels[i].tail->ByteSizeLong() : 0;
+        body_len[i] = levels[i].head->ByteSizeLong() +
+                      wire::length_delimited_header_size(levels[i].field,
+                                                         inner_len) +
+                      inner_len + level_tail_len;
+        inner_len = body_len[i];
+        tail_len += level_tail_len;
+    }
+    uint64_t buf_len = body_len[0];
+    size_t head_len = buf_len - payload_len - tail_len;
+    size_t prefix_len = sizeof(buf_len) + (tfrecord ? sizeof(uint32_t) : 0);
+    size_t trailer_len = tfrecord ? sizeof(uint32_t) : 0;
+
+    // the writer thread owns the staging buffer while it runs, let it drain
+    // everything queued before this record and keep it out meanwhile.
+    std::unique_lock<std::mutex> file_lock(file_mutex_, std::defer_lock);
+    if (writer_.joinable()) {
+        flush();
+        file_lock.lock();
+    }
+
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
+
+    // records added before this one, batched or buffered, go first.
+    close_batch(staging);
+    bool zero_copy = payload_len >= kZeroCopyMinBytes;
+    if (zero_copy && flush_buffer(staging) != 0) {
+        return -1;
+    }
+
+    // the payload is left out of the buffer when it is written from where
+    // it is, the tails then follow the heads directly.
+    size_t frame_len = prefix_len + head_len + tail_len + trailer_len;
+    if (!zero_copy) frame_len += payload_len;
+    char *frame = staging.out.reserve(frame_len);
+    char *head = frame + prefix_len;
+    char *p = head;
+    for (size_t i = 0; i < num_levels; ++i) {
+        p = reinterpret_cast<char *>(
+            levels[i].head->SerializeWithCachedSizesToArray(
+                reinterpret_cast<uint8_t *>(p)));
+        size_t next_len = i + 1 < num_levels ? body_len[i + 1] : payload_len;
+        p = wire::encode_length_delimited_header(p, levels[i].field,
+                                                 next_len);
+    }
+    if (!zero_copy && payload_len > 0) {
+        memcpy(p, payload, payload_len);
+        p += payload_len;
+    }
+    char *tail = p;
+    for (size_t i = num_levels; i-- > 0;) {
+        if (levels[i].tail == nullptr) continue;
+        p = reinterpret_cast<char *>(
+            levels[i].tail->SerializeWithCachedSizesToArray(
+                reinterpret_cast<uint8_t *>(p)));
+    }
+    memcpy(frame, &buf_len, sizeof(buf_len));
+    if (tfrecord) {
+        uint32_t len_crc =
+            masked_crc32c((char *)&buf_len, sizeof(buf_len));  // NOLINT
+        memcpy(frame + sizeof(buf_len), &len_crc, sizeof(len_crc));
+        uint32_t data_crc = crc32c(head, head_len);
+        data_crc = crc32c_extend(data_crc, payload, payload_len);
+        data_crc = mask_crc32c(crc32c_extend(data_crc, tail, tail_len));
+        memcpy(p, &data_crc, sizeof(data_crc));
+    }
+
+    if (!zero_copy) {
+        staging.out.commit(frame_len);
+        staging.records++;
+        return commit_record(staging);
+    }
+
+    // the frame around the payload sits in the (flushed, so otherwise
+    // empty) staging buffer, the payload is written from its mapping.
+    struct iovec iov[3];
+    iov[0].iov_base = frame;
+    iov[0].iov_len = prefix_len + head_len;
+    iov[1].iov_base = const_cast<char *>(payload);
+    iov[1].iov_len = payload_len;
+    iov[2].iov_base = tail;
+    iov[2].iov_len = tail_len + trailer_len;
+    int ret = write_file(iov, 3, 1);
+    if (ret == 0) {
+        staging.last_flush = std::chrono::steady_clock::now();
+    }
+    return ret;
+}
@@ -1,18 +1,22 @@
 #include <google/protobuf/text_format.h>
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "projector_config.pb.h"
 #include "web_logger.h"
+#include "wire.h"
 
 using std::endl;
 using std::ifstream;
@@ -35,10 +39,9 @@ using tensorflow::SummaryMetadata;
 using tensorflow::TensorProto;
 
 // https://github.com/dmlc/tensorboard/blob/master/python/tensorboard/summary.py#L115
-int TensorBoardLogger::generate_default_buckets() {
-    if (bucket_limits_ == nullptr) {
-        bucket_limits_ = new vector<double>;
-        vector<double> pos_buckets, neg_buckets;
+const BucketIndex &TensorBoardLogger::bucket_index() {
+    std::call_once(bucket_index_once_, [this] {
+        vector<double> limits, pos_buckets, neg_buckets;
         double v = 1e-12;
         while (v < 1e20) {
             pos_buckets.push_back(v);
@@ -48,74 +51,414 @@ int TensorBoardLogger::generate_default_buckets() {
         pos_buckets.push_back(std::numeric_limits<double>::max());
         neg_buckets.push_back(std::numeric_limits<double>::lowest());
 
-        bucket_limits_->insert(bucket_limits_->end(), neg_buckets.rbegin(),
-                               neg_buckets.rend());
-        bucket_limits_->insert(bucket_limits_->end(), pos_buckets.begin(),
-                               pos_buckets.end());
+        limits.insert(limits.end(), neg_buckets.rbegin(), neg_buckets.rend());
+        limits.insert(limits.end(), pos_buckets.begin(), pos_buckets.end());
+        bucket_index_.reset(new BucketIndex(std::move(limits)));
+    });
+    return *bucket_index_;
+}
+
+// hand encoded events are laid out the way protobuf serializes them: fields
+// in number order, proto3 defaults left out, except oneof members, which are
+// always present.
+
+// Event{wall_time, step, summary{...}}, up to the summary's contents.
+static size_t event_header_size(int64_t step, double wall_time,
+                                size_t summary_len) {
+    size_t len = wire::length_delimited_header_size(
+        Event::kSummaryFieldNumber, summary_len);
+    if (wire::double_bits(wall_time) != 0) {
+        len += wire::double_field_size(Event::kWallTimeFieldNumber);
     }
+    if (step != 0) {
+        len += wire::int64_field_size(Event::kStepFieldNumber, step);
+    }
+    return len;
+}
 
-    return 0;
+static char *encode_event_header(char *p, int64_t step, double wall_time,
+                                 size_t summary_len) {
+    if (wire::double_bits(wall_time) != 0) {
+        p = wire::encode_double_field(p, Event::kWallTimeFieldNumber,
+                                      wall_time);
+    }
+    if (step != 0) {
+        p = wire::encode_int64_field(p, Event::kStepFieldNumber, step);
+    }
+    return wire::encode_length_delimited_header(p, Event::kSummaryFieldNumber,
+                                                summary_len);
 }
 
-int TensorBoardLogger::add_scalar_tb(const string &tag, int step,
-                                     double value) {
-    auto *summary = new Summary();
+// the tag of a Summary.Value, a registered tag comes pre-encoded.
+static size_t value_tag_size(const string &tag, const InternedTag *interned) {
+    if (interned != nullptr) {
+        return interned->tb_field.size();
+    }
+    return tag.empty()
+               ? 0
+               : wire::string_field_size(Summary::Value::kTagFieldNumber, tag);
+}
+
+// starts the value as an element of `Summary.value`.
+static char *encode_value_header(char *p, size_t value_len, const string &tag,
+                                 const InternedTag *interned) {
+    p = wire::encode_length_delimited_header(p, Summary::kValueFieldNumber,
+                                             value_len);
+    if (interned != nullptr) {
+        memcpy(p, interned->tb_field.data(), interned->tb_field.size());
+        return p + interned->tb_field.size();
+    }
+    if (!tag.empty()) {
+        p = wire::encode_string_field(p, Summary::Value::kTagFieldNumber, tag);
+    }
+    return p;
+}
+
+static size_t scalar_value_size(const string &tag,
+                                const InternedTag *interned) {
+    return value_tag_size(tag, interned) +
+           wire::float_field_size(Summary::Value::kSimpleValueFieldNumber);
+}
+
+template <typename Scalars>
+int TensorBoardLogger::write_scalars_tb(int64_t step, const Scalars &scalars,
+                                        double wall_time) {
+    // Event{wall_time, step, summary{value{tag, simple_value}...}}.
+    size_t summary_len = 0;
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        size_t value_len =
+            scalar_value_size(scalars.tag(i), scalars.interned(i));
+        summary_len += wire::length_delimited_header_size(
+                           Summary::kValueFieldNumber, value_len) +
+                       value_len;
+    }
+    size_t len = event_header_size(step, wall_time, summary_len) + summary_len;
+
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
+
+    char *p = begin_event(staging, len);
+    p = encode_event_header(p, step, wall_time, summary_len);
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        const auto &tag = scalars.tag(i);
+        const auto *interned = scalars.interned(i);
+        p = encode_value_header(p, scalar_value_size(tag, interned), tag,
+                                interned);
+        p = wire::encode_float_field(p,
+                                     Summary::Value::kSimpleValueFieldNumber,
+                                     static_cast<float>(scalars.value(i)));
+    }
+    return end_event(staging, len);
+}
+
+int TensorBoardLogger::write_value_tb(
+    int64_t step, const InternedTag &tag, uint32_t field,
+    const google::protobuf::MessageLite &message, double wall_time) {
+    // Event{wall_time, step, summary{value{tag, <field>}}}.
+    size_t message_len = message.ByteSizeLong();
+    size_t value_len =
+        value_tag_size(tag.tag, &tag) +
+        wire::length_delimited_header_size(field, message_len) + message_len;
+    size_t summary_len = wire::length_delimited_header_size(
+                             Summary::kValueFieldNumber, value_len) +
+                         value_len;
+    size_t len = event_header_size(step, wall_time, summary_len) + summary_len;
+
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
+
+    char *p = begin_event(staging, len);
+    p = encode_event_header(p, step, wall_time, summary_len);
+    p = encode_value_header(p, value_len, tag.tag, &tag);
+    p = wire::encode_length_delimited_header(p, field, message_len);
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(p));
+    return end_event(staging, len);
+}
+
+int TensorBoardLogger::add_histo_tb(const InternedTag &tag, int64_t step,
+                                    HistogramProto *histo) {
+    if (writer_.joinable()) {
+        // the writer thread owns the staging buffer, queue a message.
+        auto *summary = google::protobuf::Arena::CreateMessage<Summary>(
+            histo->GetArena());
+        auto *v = summary->add_value();
+        v->set_tag(tag.tag);
+        v->set_allocated_histo(histo);
+        return add_event(step, summary);
+    }
+    int ret = write_value_tb(step, tag, Summary::Value::kHistoFieldNumber,
+                             *histo, clock_.seconds());
+    release_message(histo);
+    return ret;
+}
+
+template <typename T>
+static void reduce_bytes_tb(const BucketIndex &buckets, const T *value,
+                            size_t begin, size_t end, int64_t *counts,
+                            double *min, double *max, double *sum,
+                            double *sum_squares) {
+    const int kOffset = -std::numeric_limits<T>::min();
+    uint64_t occurrences[256] = {0};
+    for (size_t i = begin; i < end; ++i) {
+        occurrences[value[i] + kOffset]++;
+    }
+    int64_t total = 0;
+    int64_t total_squares = 0;
+    for (int byte = 0; byte < 256; ++byte) {
+        int64_t count = occurrences[byte];
+        if (count == 0) continue;
+        int64_t v = byte - kOffset;
+        counts[buckets(static_cast<double>(v))] += count;
+        total += v * count;
+        total_squares += v * v * count;
+        if (v > *max) *max = v;
+        if (v < *min) *min = v;
+    }
+    *sum += total;
+    *sum_squares += total_squares;
+}
+
+void TensorBoardLogger::reduce_histogram_tb(const BucketIndex &buckets,
+                                            HistogramValues<int8_t>,
+                                            const int8_t *value, size_t begin,
+                                            size_t end, int64_t *counts,
+                                            double *min, double *max,
+                                            double *sum,
+                                            double *sum_squares) {
+    reduce_bytes_tb(buckets, value, begin, end, counts, min, max, sum,
+                    sum_squares);
+}
+
+void TensorBoardLogger::reduce_histogram_tb(const BucketIndex &buckets,
+                                            HistogramValues<uint8_t>,
+                                            const uint8_t *value,
+                                            size_t begin, size_t end,
+                                            int64_t *counts, double *min,
+                                            double *max, double *sum,
+                                            double *sum_squares) {
+    reduce_bytes_tb(buckets, value, begin, end, counts, min, max, sum,
+                    sum_squares);
+}
+
+void TensorBoardLogger::set_histogram_tb(const BucketTotals &totals,
+                                         HistogramProto *histo) const {
+    histo->set_min(totals.min);
+    histo->set_max(totals.max);
+    histo->set_num(totals.num);
+    histo->set_sum(totals.total_sum());
+    histo->set_sum_squares(totals.total_squares());
+    for (size_t i = 0; i < totals.counts.size(); ++i) {
+        if (totals.counts[i] > 0) {
+            histo->add_bucket_limit(bucket_index_->limits()[i]);
+            histo->add_bucket(totals.counts[i]);
+        }
+    }
+}
+
+void TensorBoardLogger::scale_histogram_tb(size_t num, size_t sampled,
+                                           HistogramProto *histo) {
+    histo->set_num(num);
+    if (sampled == 0 || sampled == num) {
+        return;
+    }
+    double scale = static_cast<double>(num) / sampled;
+    histo->set_sum(histo->sum() * scale);
+    histo->set_sum_squares(histo->sum_squares() * scale);
+    for (int i = 0; i < histo->bucket_size(); ++i) {
+        histo->set_bucket(i, histo->bucket(i) * scale);
+    }
+}
+
+int TensorBoardLogger::add_histogram_tb_fp16(const std::string &tag,
+                                             int step, const uint16_t *bits,
+                                             size_t num) {
+    auto *summary = new_summary();
+    auto *v = summary->add_value();
+    v->set_tag(tag);
+    fill_histogram_tb<uint16_t, Float16Values>(bits, num, v->mutable_histo());
+    return add_event(step, summary);
+}
+
+int TensorBoardLogger::add_histogram_tb_bf16(const std::string &tag,
+                                             int step, const uint16_t *bits,
+                                             size_t num) {
+    auto *summary = new_summary();
+    auto *v = summary->add_value();
+    v->set_tag(tag);
+    fill_histogram_tb<uint16_t, BFloat16Values>(bits, num, v->mutable_histo());
+    return add_event(step, summary);
+}
+
+int TensorBoardLogger::add_histogram_tb(const std::string &tag, int step,
+                                        const DDSketch &sketch) {
+    auto *summary = new_summary();
     auto *v = summary->add_value();
     v->set_tag(tag);
-    v->set_simple_value(value);
+    auto *histo = v->mutable_histo();
+    histo->set_min(sketch.min());
+    histo->set_max(sketch.max());
+    histo->set_num(sketch.num());
+    histo->set_sum(sketch.sum());
+    histo->set_sum_squares(sketch.sum_squares());
+    for (const auto &bucket : sketch.buckets()) {
+        histo->add_bucket_limit(bucket.upper);
+        histo->add_bucket(bucket.count);
+    }
+    return add_event(step, summary);
+}
+
+HistogramAccumulator::HistogramAccumulator(TensorBoardLogger &logger)
+    : logger_(logger), visualdl_(false) {}
+
+HistogramAccumulator::HistogramAccumulator(TensorBoardLogger &logger,
+                                           int bins, double min, double max)
+    : logger_(logger), visualdl_(true) {
+    if (bins < 1 || !(min < max) || !std::isfinite(max - min)) {
+        throw std::invalid_argument(
+            "histogram needs at least one bin over a finite, non empty range");
+    }
+    bins_ = BinTotals(bins, min, (max - min) / bins);
+}
+
+int HistogramAccumulator::emit(const std::string &tag, int step,
+                               time_t walltime) {
+    if (!visualdl_) {
+        auto *summary = logger_.new_summary();
+        auto *v = summary->add_value();
+        v->set_tag(tag);
+        logger_.set_histogram_tb(buckets_, v->mutable_histo());
+        return logger_.add_event(step, summary);
+    }
+
+    auto *record = logger_.new_record();
+    auto *v = record->add_values();
+    v->set_id(step);
+    v->set_tag(tag);
+    v->set_timestamp(walltime < 0 ? logger_.clock_.millis() : walltime);
+    TensorBoardLogger::set_histogram(bins_, v->mutable_histogram());
+    return logger_.add_record(record);
+}
+
+void HistogramAccumulator::reset() {
+    buckets_ = BucketTotals();
+    std::fill(bins_.counts.begin(), bins_.counts.end(), 0);
+    num_ = 0;
+}
+
+template <typename Scalars>
+int TensorBoardLogger::log_scalars_tb(int64_t step, const Scalars &scalars) {
+    if (scalars.size() == 0) {
+        return 0;
+    }
+    if (!writer_.joinable()) {
+        return write_scalars_tb(step, scalars, clock_.seconds());
+    }
+
+    // the writer thread owns the staging buffer, queue a message instead.
+    auto *summary = new_summary();
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        auto *v = summary->add_value();
+        v->set_tag(scalars.tag(i));
+        v->set_simple_value(scalars.value(i));
+    }
     return add_event(step, summary);
 }
 
+int TensorBoardLogger::add_scalar_tb(const string &tag, int step,
+                                     double value) {
+    return log_scalars_tb(step, ScalarArrays{&tag, &value, 1});
+}
+
 int TensorBoardLogger::add_scalar_tb(const string &tag, int step, float value) {
     return add_scalar_tb(tag, step, static_cast<double>(value));
 }
 
+int TensorBoardLogger::add_scalar_tb(TagHandle tag, int step, double value) {
+    return log_scalars_tb(step, InternedScalar{&checked_tag(tag), value});
+}
+
+int TensorBoardLogger::add_scalars_tb(
+    int step, const vector<std::pair<string, double>> &scalars) {
+    return log_scalars_tb(step, ScalarPairs{&scalars});
+}
+
+int TensorBoardLogger::add_scalars_tb(int step, const string *tags,
+                                      const double *values, size_t num) {
+    return log_scalars_tb(step, ScalarArrays{tags, values, num});
+}
+
 int TensorBoardLogger::add_image_tb(const string &tag, int step,
                                     const string &encoded_image, int height,
                                     int width, int channel,
                                     const string &display_name,
                                     const string &description) {
-    auto *meta = new SummaryMetadata();
+    auto *summary = new_summary();
+    auto *v = summary->add_value();
+    v->set_tag(tag);
+
+    auto *meta = v->mutable_metadata();
     meta->set_display_name(display_name.empty() ? tag : display_name);
     meta->set_summary_description(description);
 
-    auto *image = new Summary::Image();
+    auto *image = v->mutable_image();
     image->set_height(height);
     image->set_width(width);
     image->set_colorspace(channel);
     image->set_encoded_image_string(encoded_image);
-
-    auto *summary = new Summary();
-    auto *v = summary->add_value();
-    v->set_tag(tag);
-    v->set_allocated_image(image);
-    v->set_allocated_metadata(meta);
     return add_event(step, summary);
 }
 
+int TensorBoardLogger::add_image_from_path_tb(
+    const string &tag, int step, const string &path, int height, int width,
+    int channel, const string &display_name, const string &description) {
+    // Event{wall_time, step, summary{value{tag, image{height, width,
+    // colorspace, encoded_image_string}, metadata}}}, with the image bytes
+    // taken from the mapping.
+    MappedFile file(path);
+    Event event;
+    event.set_wall_time(clock_.seconds());
+    event.set_step(step);
+    Summary summary;
+    Summary::Value value;
+    value.set_tag(tag);
+    Summary::Value value_tail;
+    auto *meta = value_tail.mutable_metadata();
+    meta->set_display_name(display_name.empty() ? tag : display_name);
+    meta->set_summary_description(description);
+    Summary::Image image;
+    image.set_height(height);
+    image.set_width(width);
+    image.set_colorspace(channel);
+    const NestedField levels[] = {
+        {&event, Event::kSummaryFieldNumber, nullptr},
+        {&summary, Summary::kValueFieldNumber, nullptr},
+        {&value, Summary::Value::kImageFieldNumber, &value_tail},
+        {&image, Summary::Image::kEncodedImageStringFieldNumber, nullptr},
+    };
+    return write_nested(levels, 4, file.data(), file.size(), true);
+}
+
 int TensorBoardLogger::add_images_tb(
     const std::string &tag, int step,
     const std::vector<std::string> &encoded_images, int height, int width,
     const std::string &display_name, const std::string &description) {
-    auto *plugin_data = new SummaryMetadata::PluginData();
-    plugin_data->set_plugin_name("images");
-    auto *meta = new SummaryMetadata();
+    auto *summary = new_summary();
+    auto *v = summary->add_value();
+    v->set_tag(tag);
+
+    auto *meta = v->mutable_metadata();
     meta->set_display_name(display_name.empty() ? tag : display_name);
     meta->set_summary_description(description);
-    meta->set_allocated_plugin_data(plugin_data);
+    meta->mutable_plugin_data()->set_plugin_name("images");
 
-    auto *tensor = new TensorProto();
+    auto *tensor = v->mutable_tensor();
     tensor->set_dtype(tensorflow::DataType::DT_STRING);
     tensor->add_string_val(to_string(width));
     tensor->add_string_val(to_string(height));
     for (const auto &image : encoded_images) tensor->add_string_val(image);
 
-    auto *summary = new Summary();
-    auto *v = summary->add_value();
-    v->set_tag(tag);
-    v->set_allocated_tensor(tensor);
-    v->set_allocated_metadata(meta);
-
     return add_event(step, summary);
 }
 
@@ -123,45 +466,72 @@ int TensorBoardLogger::add_audio_tb(
     const string &tag, int step, const string &encoded_audio, float sample_rate,
     int num_channels, int length_frame, const string &content_type,
     const string &display_name, const string &description) {
-    auto *meta = new SummaryMetadata();
+    auto *summary = new_summary();
+    auto *v = summary->add_value();
+    v->set_tag(tag);
+
+    auto *meta = v->mutable_metadata();
     meta->set_display_name(display_name.empty() ? tag : display_name);
     meta->set_summary_description(description);
 
-    auto *audio = new Summary::Audio();
+    auto *audio = v->mutable_audio();
     audio->set_sample_rate(sample_rate);
     audio->set_num_channels(num_channels);
     audio->set_length_frames(length_frame);
     audio->set_encoded_audio_string(encoded_audio);
     audio->set_content_type(content_type);
-
-    auto *summary = new Summary();
-    auto *v = summary->add_value();
-    v->set_tag(tag);
-    v->set_allocated_audio(audio);
-    v->set_allocated_metadata(meta);
     return add_event(step, summary);
 }
 
+int TensorBoardLogger::add_audio_from_path_tb(
+    const string &tag, int step, const string &path, float sample_rate,
+    int num_channels, int length_frame, const string &content_type,
+    const string &display_name, const string &description) {
+    // Event{wall_time, step, summary{value{tag, audio{sample_rate,
+    // num_channels, length_frames, encoded_audio_string, content_type},
+    // metadata}}}, with the audio bytes taken from the mapping.
+    MappedFile file(path);
+    Event event;
+    event.set_wall_time(clock_.seconds());
+    event.set_step(step);
+    Summary summary;
+    Summary::Value value;
+    value.set_tag(tag);
+    Summary::Value value_tail;
+    auto *meta = value_tail.mutable_metadata();
+    meta->set_display_name(display_name.empty() ? tag : display_name);
+    meta->set_summary_description(description);
+    Summary::Audio audio;
+    audio.set_sample_rate(sample_rate);
+    audio.set_num_channels(num_channels);
+    audio.set_length_frames(length_frame);
+    Summary::Audio audio_tail;
+    audio_tail.set_content_type(content_type);
+    const NestedField levels[] = {
+        {&event, Event::kSummaryFieldNumber, nullptr},
+        {&summary, Summary::kValueFieldNumber, nullptr},
+        {&value, Summary::Value::kAudioFieldNumber, &value_tail},
+        {&audio, Summary::Audio::kEncodedAudioStringFieldNumber,
+         &audio_tail},
+    };
+    return write_nested(levels, 4, file.data(), file.size(), true);
+}
+
 int TensorBoardLogger::add_text_tb(const string &tag, int step,
                                    const char *text) {
-    auto *plugin_data = new SummaryMetadata::PluginData();
-    plugin_data->set_plugin_name(kTextPluginName);
+    auto *summary = new_summary();
+    auto *v = summary->add_value();
+    v->set_tag(tag);
 
-    auto *meta = new SummaryMetadata();
-    meta->set_allocated_plugin_data(plugin_data);
+    auto *meta = v->mutable_metadata();
+    meta->mutable_plugin_data()->set_plugin_name(kTextPluginName);
 
-    auto *tensor = new TensorProto();
+    auto *tensor = v->mutable_tensor();
     tensor->set_dtype(tensorflow::DataType::DT_STRING);
 
     auto *str_val = tensor->add_string_val();
     *str_val = text;
 
-    auto *summary = new Summary();
-    auto *v = summary->add_value();
-    v->set_tag(tag);
-    v->set_allocated_tensor(tensor);
-    v->set_allocated_metadata(meta);
-
     return add_event(step, summary);
 }
 
@@ -169,24 +539,19 @@ int TensorBoardLogger::add_embedding_tb(
     const std::string &tensor_name, const std::string &tensordata_path,
     const std::string &metadata_path, const std::vector<uint32_t> &tensor_shape,
     int step) {
-    auto *plugin_data = new SummaryMetadata::PluginData();
-    plugin_data->set_plugin_name(kProjectorPluginName);
-    auto *meta = new SummaryMetadata();
-    meta->set_allocated_plugin_data(plugin_data);
-
     const auto &filename = log_dir_ + kProjectorConfigFile;
-    auto *conf = new ProjectorConfig();
+    ProjectorConfig conf;
 
     // parse possibly existing config file
     ifstream fin(filename);
     if (fin.is_open()) {
         ostringstream ss;
         ss << fin.rdbuf();
-        TextFormat::ParseFromString(ss.str(), conf);
+        TextFormat::ParseFromString(ss.str(), &conf);
         fin.close();
     }
 
-    auto *embedding = conf->add_embeddings();
+    auto *embedding = conf.add_embeddings();
     embedding->set_tensor_name(tensor_name);
     embedding->set_tensor_path(tensordata_path);
     if (metadata_path != "") {
@@ -196,19 +561,18 @@ int TensorBoardLogger::add_embedding_tb(
         for (auto shape : tensor_shape) embedding->add_tensor_shape(shape);
     }
 
-    // `conf` and `embedding` will be deleted by ProjectorConfig destructor
-
     ofstream fout(filename);
     string content;
-    TextFormat::PrintToString(*conf, &content);
+    TextFormat::PrintToString(conf, &content);
     fout << content;
     fout.close();
 
     // Following line is just to add plugin and does not hold any meaning
-    auto *summary = new Summary();
+    auto *summary = new_summary();
     auto *v = summary->add_value();
     v->set_tag("embedding");
-    v->set_allocated_metadata(meta);
+    v->mutable_metadata()->mutable_plugin_data()->set_plugin_name(
+        kProjectorPluginName);
 
     return add_event(step, summary);
 }
@@ -285,26 +649,53 @@ int TensorBoardLogger::add_embedding_tb(
 }
 
 int TensorBoardLogger::add_event(int64_t step, Summary *summary) {
-    Event event;
-    double wall_time = time(nullptr);
-    event.set_wall_time(wall_time);
-    event.set_step(step);
-    event.set_allocated_summary(summary);
-    return write(event);
+    // the event shares the arena of its summary, no copy is made.
+    auto *event = google::protobuf::Arena::CreateMessage<Event>(
+        summary->GetArena());
+    double wall_time = clock_.seconds();
+    event->set_wall_time(wall_time);
+    event->set_step(step);
+    event->set_allocated_summary(summary);
+    if (writer_.joinable()) {
+        PendingWrite pending;
+        pending.event = event;
+        return enqueue(std::move(pending));
+    }
+    int ret = write(*event);
+    release_message(event);
+    return ret;
 }
 
 int TensorBoardLogger::write(Event &event) {
-    string buf;
-    event.SerializeToString(&buf);
-    auto buf_len = static_cast<uint64_t>(buf.size());
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
+
+    size_t len = event.ByteSizeLong();
+    char *buf = begin_event(staging, len);
+    event.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(buf));
+    return end_event(staging, len);
+}
+
+char *TensorBoardLogger::begin_event(Staging &staging, size_t len) {
+    // frame the event in place: length, masked crc of length, payload,
+    // masked crc of payload.
+    char *frame = staging.out.reserve(len + kTFRecordOverhead);
+    return frame + sizeof(uint64_t) + sizeof(uint32_t);
+}
+
+int TensorBoardLogger::end_event(Staging &staging, size_t len) {
+    auto buf_len = static_cast<uint64_t>(len);
+    char *frame = staging.out.data() + staging.out.size();
+    char *payload = frame + sizeof(buf_len) + sizeof(uint32_t);
+
     uint32_t len_crc =
         masked_crc32c((char *)&buf_len, sizeof(buf_len));  // NOLINT
-    uint32_t data_crc = masked_crc32c(buf.c_str(), buf.size());
-
-    ofs_->write((char *)&buf_len, sizeof(buf_len));  // NOLINT
-    ofs_->write((char *)&len_crc, sizeof(len_crc));  // NOLINT
-    ofs_->write(buf.c_str(), buf.size());
-    ofs_->write((char *)&data_crc, sizeof(data_crc));  // NOLINT
-    ofs_->flush();
-    return 0;
+    uint32_t data_crc = masked_crc32c(payload, buf_len);
+    memcpy(frame, &buf_len, sizeof(buf_len));
+    memcpy(frame + sizeof(buf_len), &len_crc, sizeof(len_crc));
+    memcpy(payload + buf_len, &data_crc, sizeof(data_crc));
+    staging.out.commit(len + kTFRecordOverhead);
+    staging.records++;
+    return commit_record(staging);
 }
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 #include <iostream>
@@ -14,6 +15,7 @@
 #include "md5.h"
 #include "record.pb.h"
 #include "web_logger.h"
+#include "wire.h"
 
 using std::endl;
 using std::ifstream;
@@ -41,38 +43,298 @@ using visualdl::Record_ROC_Curve;
 using visualdl::Record_Text;
 using visualdl::Record_Value;
 
+// the fields every Record.Value starts with, {id, tag, timestamp}, laid out
+// the way protobuf serializes them: in number order, proto3 defaults left
+// out.  a registered tag comes pre-encoded.  the oneof member that follows
+// is always present.
+static size_t value_header_size(int64_t id, const string &tag,
+                                const InternedTag *interned,
+                                int64_t timestamp) {
+    size_t len = 0;
+    if (id != 0) {
+        len += wire::int64_field_size(Record_Value::kIdFieldNumber, id);
+    }
+    if (interned != nullptr) {
+        len += interned->vdl_field.size();
+    } else if (!tag.empty()) {
+        len += wire::string_field_size(Record_Value::kTagFieldNumber, tag);
+    }
+    if (timestamp != 0) {
+        len += wire::int64_field_size(Record_Value::kTimestampFieldNumber,
+                                      timestamp);
+    }
+    return len;
+}
+
+// starts the value as an element of `Record.values`.
+static char *encode_value_header(char *p, size_t value_len, int64_t id,
+                                 const string &tag,
+                                 const InternedTag *interned,
+                                 int64_t timestamp) {
+    p = wire::encode_length_delimited_header(p, Record::kValuesFieldNumber,
+                                             value_len);
+    if (id != 0) {
+        p = wire::encode_int64_field(p, Record_Value::kIdFieldNumber, id);
+    }
+    if (interned != nullptr) {
+        memcpy(p, interned->vdl_field.data(), interned->vdl_field.size());
+        p += interned->vdl_field.size();
+    } else if (!tag.empty()) {
+        p = wire::encode_string_field(p, Record_Value::kTagFieldNumber, tag);
+    }
+    if (timestamp != 0) {
+        p = wire::encode_int64_field(p, Record_Value::kTimestampFieldNumber,
+                                     timestamp);
+    }
+    return p;
+}
+
+static size_t scalar_value_size(int64_t id, const string &tag,
+                                const InternedTag *interned,
+                                int64_t timestamp) {
+    return value_header_size(id, tag, interned, timestamp) +
+           wire::float_field_size(Record_Value::kValueFieldNumber);
+}
+
+template <typename Scalars>
+int TensorBoardLogger::write_scalars(int64_t step, const Scalars &scalars,
+                                     int64_t walltime) {
+    size_t len = 0;
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        size_t value_len = scalar_value_size(step, scalars.tag(i),
+                                             scalars.interned(i), walltime);
+        len += wire::length_delimited_header_size(Record::kValuesFieldNumber,
+                                                  value_len) +
+               value_len;
+    }
+
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
+
+    char *p = begin_record(staging, len);
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        const auto &tag = scalars.tag(i);
+        const auto *interned = scalars.interned(i);
+        p = encode_value_header(
+            p, scalar_value_size(step, tag, interned, walltime), step, tag,
+            interned, walltime);
+        p = wire::encode_float_field(p, Record_Value::kValueFieldNumber,
+                                     static_cast<float>(scalars.value(i)));
+    }
+    return end_record(staging, len, scalars.size());
+}
+
+int TensorBoardLogger::write_value(
+    int64_t step, const InternedTag &tag, int64_t walltime, uint32_t field,
+    const google::protobuf::MessageLite &message) {
+    size_t message_len = message.ByteSizeLong();
+    size_t value_len =
+        value_header_size(step, tag.tag, &tag, walltime) +
+        wire::length_delimited_header_size(field, message_len) + message_len;
+    size_t len = wire::length_delimited_header_size(
+                     Record::kValuesFieldNumber, value_len) +
+                 value_len;
+
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
+
+    char *p = begin_record(staging, len);
+    p = encode_value_header(p, value_len, step, tag.tag, &tag, walltime);
+    p = wire::encode_length_delimited_header(p, field, message_len);
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(p));
+    return end_record(staging, len, 1);
+}
+
+template <typename Scalars>
+int TensorBoardLogger::log_scalars(int64_t step, const Scalars &scalars,
+                                   int64_t walltime) {
+    if (scalars.size() == 0) {
+        return 0;
+    }
+    if (walltime < 0) {
+        walltime = clock_.millis();
+    }
+    if (!writer_.joinable()) {
+        return write_scalars(step, scalars, walltime);
+    }
+
+    // the writer thread owns the staging buffer, queue a message instead.
+    auto *record = new_record();
+    for (size_t i = 0; i < scalars.size(); ++i) {
+        auto v = record->add_values();
+        v->set_id(step);
+        v->set_tag(scalars.tag(i));
+        v->set_timestamp(walltime);
+        v->set_value(static_cast<float>(scalars.value(i)));
+    }
+
+    return add_record(record);
+}
+
 int TensorBoardLogger::add_scalar(const string &tag, int step, double value,
                                   time_t walltime) {
-    if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
+    return log_scalars(step, ScalarArrays{&tag, &value, 1}, walltime);
+}
+
+int TensorBoardLogger::add_scalar(TagHandle tag, int step, double value,
+                                  time_t walltime) {
+    return log_scalars(step, InternedScalar{&checked_tag(tag), value}, walltime);
+}
+
+int TensorBoardLogger::add_scalars(
+    int step, const vector<std::pair<string, double>> &scalars,
+    time_t walltime) {
+    return log_scalars(step, ScalarPairs{&scalars}, walltime);
+}
+
+int TensorBoardLogger::add_scalars(int step, const string *tags,
+                                   const double *values, size_t num,
+                                   time_t walltime) {
+    return log_scalars(step, ScalarArrays{tags, values, num}, walltime);
+}
+
+template <typename T>
+static void count_byte_bins(const BinTotals &totals, const T *value,
+                            size_t begin, size_t end, int64_t *count) {
+    const int kOffset = -std::numeric_limits<T>::min();
+    int64_t occurrences[256] = {0};
+    for (size_t i = begin; i < end; ++i) {
+        occurrences[value[i] + kOffset]++;
+    }
+    for (int byte = 0; byte < 256; ++byte) {
+        if (occurrences[byte] > 0) {
+            count[totals.bin(byte - kOffset)] += occurrences[byte];
+        }
+    }
+}
+
+void TensorBoardLogger::count_bins(const BinTotals &totals,
+                                   HistogramValues<int8_t>,
+                                   const int8_t *value, size_t begin,
+                                   size_t end, int64_t *count) {
+    count_byte_bins(totals, value, begin, end, count);
+}
+
+void TensorBoardLogger::count_bins(const BinTotals &totals,
+                                   HistogramValues<uint8_t>,
+                                   const uint8_t *value, size_t begin,
+                                   size_t end, int64_t *count) {
+    count_byte_bins(totals, value, begin, end, count);
+}
+
+void TensorBoardLogger::set_histogram(const BinTotals &totals,
+                                      Record_Histogram *hist) {
+    for (size_t i = 0; i <= totals.counts.size(); ++i) {
+        hist->add_bin_edges(totals.edge(i));
+    }
+    for (int64_t count : totals.counts) {
+        hist->add_hist(count);
     }
-    auto *record = new Record();
+}
+
+void TensorBoardLogger::scale_histogram(size_t num, size_t sampled,
+                                       Record_Histogram *hist) {
+    if (sampled == 0 || sampled == num) {
+        return;
+    }
+    double scale = static_cast<double>(num) / sampled;
+    for (int i = 0; i < hist->hist_size(); ++i) {
+        hist->set_hist(i, hist->hist(i) * scale);
+    }
+}
+
+int TensorBoardLogger::add_histogram_fp16(const std::string &tag, int step,
+                                          int bins, const uint16_t *bits,
+                                          size_t num, time_t walltime) {
+    auto *record = new_record();
     auto v = record->add_values();
     v->set_id(step);
     v->set_tag(tag);
-    v->set_timestamp(walltime);
-    v->set_value(static_cast<float>(value));
+    v->set_timestamp(walltime < 0 ? clock_.millis() : walltime);
+    fill_histogram<uint16_t, Float16Values>(bins, bits, num,
+                                            v->mutable_histogram());
+    return add_record(record);
+}
+
+int TensorBoardLogger::add_histogram_bf16(const std::string &tag, int step,
+                                          int bins, const uint16_t *bits,
+                                          size_t num, time_t walltime) {
+    auto *record = new_record();
+    auto v = record->add_values();
+    v->set_id(step);
+    v->set_tag(tag);
+    v->set_timestamp(walltime < 0 ? clock_.millis() : walltime);
+    fill_histogram<uint16_t, BFloat16Values>(bins, bits, num,
+                                             v->mutable_histogram());
+    return add_record(record);
+}
 
+int TensorBoardLogger::add_histogram(const std::string &tag, int step,
+                                     const DDSketch &sketch, time_t walltime) {
+    auto *record = new_record();
+    auto v = record->add_values();
+    v->set_id(step);
+    v->set_tag(tag);
+    v->set_timestamp(walltime < 0 ? clock_.millis() : walltime);
+    auto *hist = v->mutable_histogram();
+    for (const auto &bucket : sketch.buckets()) {
+        if (hist->bin_edges_size() == 0) {
+            hist->add_bin_edges(bucket.lower);
+        } else if (hist->bin_edges(hist->bin_edges_size() - 1) <
+                   bucket.lower) {
+            hist->add_hist(0);
+            hist->add_bin_edges(bucket.lower);
+        }
+        hist->add_hist(bucket.count);
+        hist->add_bin_edges(bucket.upper);
+    }
     return add_record(record);
 }
 
+int TensorBoardLogger::add_histogram_value(const InternedTag &tag,
+                                           int64_t step, int64_t walltime,
+                                           Record_Histogram *hist) {
+    if (writer_.joinable()) {
+        // the writer thread owns the staging buffer, queue a message.
+        auto *record = google::protobuf::Arena::CreateMessage<Record>(
+            hist->GetArena());
+        auto v = record->add_values();
+        v->set_id(step);
+        v->set_tag(tag.tag);
+        v->set_timestamp(walltime);
+        v->set_allocated_histogram(hist);
+        return add_record(record);
+    }
+    int ret = write_value(step, tag, walltime,
+                          Record_Value::kHistogramFieldNumber, *hist);
+    release_message(hist);
+    return ret;
+}
+
 int TensorBoardLogger::add_meta(const std::string &tag,
                                 const std::string &display_name, int64_t step,
                                 time_t timestamp) {
     if (timestamp < 0) {
-        timestamp = time(nullptr) * 1000;
+        timestamp = clock_.millis();
     }
 
-    auto *meta = new Record_MetaData();
-    meta->set_display_name(display_name);
-
-    auto *record = new Record();
+    auto *record = new_record();
     auto v = record->add_values();
     v->set_id(step);
     v->set_tag(tag);
     v->set_timestamp(timestamp);
-    v->set_allocated_meta_data(meta);
+    v->mutable_meta_data()->set_display_name(display_name);
 
+    if (rotation_.enabled()) {
+        // VisualDL reads the display name per file.
+        string payload = record->SerializeAsString();
+        uint64_t len = payload.size();
+        std::lock_guard<std::mutex> lock(rotation_mutex_);
+        meta_record_.assign(reinterpret_cast<const char *>(&len), sizeof(len));
+        meta_record_ += payload;
+    }
     return add_record(record);
 }
 
@@ -80,18 +342,15 @@ int TensorBoardLogger::add_image(const std::string &tag, int step,
                                  const std::string &encoded_image,
                                  time_t walltime) {
     if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
+        walltime = clock_.millis();
     }
 
-    auto *image = new Record_Image();
-    image->set_encoded_image_string(encoded_image);
-
-    auto *record = new Record();
+    auto *record = new_record();
     auto v = record->add_values();
     v->set_id(step);
     v->set_tag(tag);
     v->set_timestamp(walltime);
-    v->set_allocated_image(image);
+    v->mutable_image()->set_encoded_image_string(encoded_image);
 
     return add_record(record);
 }
@@ -99,26 +358,42 @@ int TensorBoardLogger::add_image(const std::string &tag, int step,
 int TensorBoardLogger::add_image_from_path(const std::string &tag, int step,
                                            const std::string &path,
                                            time_t walltime) {
-    return add_image(tag, step, read_binary_file(path), walltime);
+    if (walltime < 0) {
+        walltime = clock_.millis();
+    }
+
+    // Record{values{id, tag, timestamp, image{encoded_image_string}}}, with
+    // the image bytes taken from the mapping.
+    MappedFile file(path);
+    Record record;
+    Record_Value value;
+    value.set_id(step);
+    value.set_tag(tag);
+    value.set_timestamp(walltime);
+    Record_Image image;
+    const NestedField levels[] = {
+        {&record, Record::kValuesFieldNumber},
+        {&value, Record_Value::kImageFieldNumber},
+        {&image, Record_Image::kEncodedImageStringFieldNumber},
+    };
+    return write_nested(levels, 3, file.data(), file.size(), false);
 }
 
 int TensorBoardLogger::add_audio(const std::string &tag, int step,
                                  const std::string &encoded_audio,
                                  float sample_rate, time_t walltime) {
     if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
+        walltime = clock_.millis();
     }
 
-    auto *audio = new Record_Audio();
-    audio->set_encoded_audio_string(encoded_audio);
-    audio->set_sample_rate(sample_rate);
-
-    auto *record = new Record();
+    auto *record = new_record();
     auto v = record->add_values();
     v->set_id(step);
     v->set_tag(tag);
     v->set_timestamp(walltime);
-    v->set_allocated_audio(audio);
+    auto *audio = v->mutable_audio();
+    audio->set_encoded_audio_string(encoded_audio);
+    audio->set_sample_rate(sample_rate);
 
     return add_record(record);
 }
@@ -126,24 +401,38 @@ int TensorBoardLogger::add_audio(const std::string &tag, int step,
 int TensorBoardLogger::add_audio_from_path(const std::string &tag, int step,
                                            const std::string &path,
                                            float sample_rate, time_t walltime) {
-    return add_audio(tag, step, read_binary_file(path), sample_rate, walltime);
+    if (walltime < 0) {
+        walltime = clock_.millis();
+    }
+
+    MappedFile file(path);
+    Record record;
+    Record_Value value;
+    value.set_id(step);
+    value.set_tag(tag);
+    value.set_timestamp(walltime);
+    Record_Audio audio;
+    audio.set_sample_rate(sample_rate);
+    const NestedField levels[] = {
+        {&record, Record::kValuesFieldNumber},
+        {&value, Record_Value::kAudioFieldNumber},
+        {&audio, Record_Audio::kEncodedAudioStringFieldNumber},
+    };
+    return write_nested(levels, 3, file.data(), file.size(), false);
 }
 
 int TensorBoardLogger::add_text(const std::string &tag, int step,
                                 const std::string &text, time_t walltime) {
     if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
+        walltime = clock_.millis();
     }
 
-    auto *_text = new Record_Text();
-    _text->set_encoded_text_string(text);
-
-    auto *record = new Record();
+    auto *record = new_record();
     auto v = record->add_values();
     v->set_id(step);
     v->set_tag(tag);
     v->set_timestamp(walltime);
-    v->set_allocated_text(_text);
+    v->mutable_text()->set_encoded_text_string(text);
 
     return add_record(record);
 }
@@ -183,10 +472,15 @@ int TensorBoardLogger::add_embeddings(
     }
 
     if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
+        walltime = clock_.millis();
     }
 
-    auto *embs = new Record_Embeddings();
+    auto *record = new_record();
+    auto v = record->add_values();
+    v->set_id(0);
+    v->set_tag(tag);
+    v->set_timestamp(walltime);
+    auto *embs = v->mutable_embeddings();
 
     for (const auto &meta : metadata_header) {
         embs->add_label_meta(meta);
@@ -199,18 +493,11 @@ int TensorBoardLogger::add_embeddings(
         for (const auto &meta : metadata) {
             emb->add_label(meta[i]);
         }
-        for (const auto &v : mat[i]) {
-            emb->add_vectors(v);
+        for (const auto &x : mat[i]) {
+            emb->add_vectors(x);
         }
     }
 
-    auto *record = new Record();
-    auto v = record->add_values();
-    v->set_id(0);
-    v->set_tag(tag);
-    v->set_timestamp(walltime);
-    v->set_allocated_embeddings(embs);
-
     return add_record(record);
 }
 
@@ -218,12 +505,17 @@ int TensorBoardLogger::add_hparams(
     const std::map<std::string, std::string> &hparams_dict,
     const std::vector<std::string> &metrics_list, time_t walltime) {
     if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
+        walltime = clock_.millis();
     }
 
-    string name = md5(log_file_);
+    string name = md5(log_file());
 
-    auto *hparams = new Record_HParam();
+    auto *record = new_record();
+    auto *value = record->add_values();
+    value->set_id(1);
+    value->set_tag("hparam");
+    value->set_timestamp(walltime);
+    auto *hparams = value->mutable_hparam();
     hparams->set_name(name);
 
     for (const auto &pair : hparams_dict) {
@@ -266,38 +558,120 @@ int TensorBoardLogger::add_hparams(
         metric_info->set_float_value(0);
     }
 
-    auto *record = new Record();
-    auto v = record->add_values();
-    v->set_id(1);
-    v->set_tag("hparam");
-    v->set_timestamp(walltime);
-    v->set_allocated_hparam(hparams);
-
     return add_record(record);
 }
 
-// todo: merge with calculate_hist_bins in web_logger.h
-vector<int> calc_hist(const vector<int> &values, const vector<double> &labels,
-                      double weights, int bins, double upper,
-                      double lower = 0.0) {
-    vector<double> v(values.size(), weights);
-    for (size_t i = 0; i < values.size(); ++i) {
-        v[i] *= double(values[i]) * labels[i];
-    }
-    vector<double> bounds(bins + 1);
-    double interval = (upper - lower) / bins;
-    for (size_t i = 0; i < bins + 1; ++i) {
-        bounds[i] = i * interval + lower;
-    }
-    vector<int> count(bins, 0);
-    for (auto t : v) {
-        auto pos = std::lower_bound(bounds.begin(), bounds.end(), t);
-        if (pos != bounds.end()) {
-            // todo: ignore values larger than upper.
-            count[pos - bounds.begin()] += 1;
+const size_t CurveTotals::kBlock;
+
+CurveTotals::CurveTotals(int num_thresholds)
+    : bins(num_thresholds),
+      tp(num_thresholds),
+      fp(num_thresholds),
+      block(2 * num_thresholds) {
+    // num_thresholds equal bins over the bucket indices [0, last], as
+    // numpy.histogram assigns them, looked up by index.
+    const int last = num_thresholds - 1;
+    vector<double> edges(num_thresholds + 1);
+    double step = double(last) / num_thresholds;
+    for (int k = 0; k < num_thresholds; ++k) {
+        edges[k] = k * step;
+    }
+    edges[num_thresholds] = last;
+    double norm = num_thresholds / double(last);
+    for (int index = 0; index <= last; ++index) {
+        int bin = std::min(static_cast<int>(index * norm), last);
+        if (index < edges[bin]) {
+            bin--;
+        } else if (bin != last && index >= edges[bin + 1]) {
+            bin++;
+        }
+        bins[index] = bin;
+    }
+}
+
+template <typename T>
+static void add_curve_values(CurveTotals &totals, const T *labels,
+                             const T *predictions, size_t num,
+                             const T *weights, double weight) {
+    const int last = static_cast<int>(totals.bins.size()) - 1;
+    size_t i = 0;
+    while (i < num) {
+        size_t begin = i;
+        size_t end = std::min(num, begin + (CurveTotals::kBlock -
+                                            totals.block_fill));
+        for (; i < end; ++i) {
+            // the bucket index is floor(x), out of range (or NaN)
+            // predictions are left out.  in range, truncation is the floor.
+            double x = predictions[i] * double(last);
+            if (!(x >= 0 && x < last + 1)) {
+                continue;
+            }
+            int bin = totals.bins[static_cast<int>(x)];
+            double w = weights != nullptr ? weights[i] : weight;
+            double *sum = &totals.block[2 * bin];
+            sum[0] += labels[i] * w;
+            sum[1] += (1.0 - labels[i]) * w;
+        }
+        totals.block_fill += end - begin;
+        if (totals.block_fill == CurveTotals::kBlock) {
+            totals.close_block();
+        }
+    }
+}
+
+void CurveTotals::add(const double *labels, const double *predictions,
+                      size_t num, const double *weights, double weight) {
+    add_curve_values(*this, labels, predictions, num, weights, weight);
+}
+
+void CurveTotals::add(const float *labels, const float *predictions,
+                      size_t num, const float *weights, double weight) {
+    add_curve_values(*this, labels, predictions, num, weights, weight);
+}
+
+void CurveTotals::close_block() {
+    for (size_t k = 0; k < bins.size(); ++k) {
+        tp[k] += block[2 * k];
+        fp[k] += block[2 * k + 1];
+        block[2 * k] = 0.0;
+        block[2 * k + 1] = 0.0;
+    }
+    block_fill = 0;
+}
+
+void CurveTotals::merge(const CurveTotals &other) {
+    if (other.bins.size() != bins.size()) {
+        throw std::invalid_argument("curves of different num_thresholds");
+    }
+    for (size_t k = 0; k < bins.size(); ++k) {
+        tp[k] += other.tp[k] + other.block[2 * k];
+        fp[k] += other.fp[k] + other.block[2 * k + 1];
+    }
+}
+
+vector<double> CurveTotals::total_tp() const {
+    vector<double> total = tp;
+    if (block_fill > 0) {
+        for (size_t k = 0; k < bins.size(); ++k) total[k] += block[2 * k];
+    }
+    return total;
+}
+
+vector<double> CurveTotals::total_fp() const {
+    vector<double> total = fp;
+    if (block_fill > 0) {
+        for (size_t k = 0; k < bins.size(); ++k) {
+            total[k] += block[2 * k + 1];
         }
     }
-    return count;
+    return total;
+}
+
+int TensorBoardLogger::curve_thresholds(int num_thresholds) {
+    if (num_thresholds < 2) {
+        throw std::invalid_argument("num_thresholds must be at least 2");
+    }
+    return num_thresholds;
 }
 
 int TensorBoardLogger::add_pr_curve(const std::string &tag,
@@ -325,117 +699,346 @@ int TensorBoardLogger::add_curve(const std::string &type,
                                  int step, int num_thresholds, time_t walltime,
                                  double weights) {
     if (walltime < 0) {
-        walltime = time(nullptr) * 1000;
-    }
-
-    // todo: parameter validation
-    if (num_thresholds > 127) {
-        std::cout
-            << "warning, num_thresholds can not be larger than 127, set as 127."
-            << endl;
-        num_thresholds = 127;
+        walltime = clock_.millis();
     }
 
-    // todo: int64_
-    vector<int> bucket_indices(predictions.size(), 0);
-    for (size_t i = 0; i < predictions.size(); ++i) {
-        bucket_indices[i] =
-            static_cast<int>(floor(predictions[i] * (num_thresholds - 1)));
+    if (labels.size() != predictions.size()) {
+        throw std::invalid_argument(
+            "labels and predictions must have the same size");
     }
+    CurveTotals totals(curve_thresholds(num_thresholds));
+    totals.add(labels.data(), predictions.data(), labels.size(), nullptr,
+               weights);
+    return write_curve(type, tag, step, walltime, totals);
+}
 
-    auto tp_buckets = calc_hist(bucket_indices, labels, weights, num_thresholds,
-                                num_thresholds - 1);
-
-    vector<double> neg_labels(labels.size(), 0.0);
-    for (size_t i = 0; i < labels.size(); ++i) {
-        neg_labels[i] = 1.0 - labels[i];
+int TensorBoardLogger::add_pr_curve(const std::string &tag,
+                                    const float *labels,
+                                    const float *predictions, size_t num,
+                                    int step, int num_thresholds,
+                                    time_t walltime, double weights) {
+    return add_curve("pr_curve", tag, labels, predictions, num, step,
+                     num_thresholds, walltime, weights);
+}
+int TensorBoardLogger::add_roc_curve(const std::string &tag,
+                                     const float *labels,
+                                     const float *predictions, size_t num,
+                                     int step, int num_thresholds,
+                                     time_t walltime, double weights) {
+    return add_curve("roc_curve", tag, labels, predictions, num, step,
+                     num_thresholds, walltime, weights);
+}
+int TensorBoardLogger::add_curve(const std::string &type,
+                                 const std::string &tag, const float *labels,
+                                 const float *predictions, size_t num,
+                                 int step, int num_thresholds, time_t walltime,
+                                 double weights) {
+    if (walltime < 0) {
+        walltime = clock_.millis();
     }
-    auto fp_buckets = calc_hist(bucket_indices, neg_labels, weights,
-                                num_thresholds, num_thresholds - 1);
-
-    vector<int> tp(num_thresholds, 0);
-    vector<int> fp(num_thresholds, 0);
-    vector<int> tn(num_thresholds, 0);
-    vector<int> fn(num_thresholds, 0);
-
-    std::reverse(tp_buckets.begin(), tp_buckets.end());
-    std::reverse(fp_buckets.begin(), fp_buckets.end());
-    std::partial_sum(tp_buckets.begin(), tp_buckets.end(), tp.begin());
-    std::partial_sum(fp_buckets.begin(), fp_buckets.end(), fp.begin());
-    std::reverse(tp.begin(), tp.end());
-    std::reverse(fp.begin(), fp.end());
+    CurveTotals totals(curve_thresholds(num_thresholds));
+    totals.add(labels, predictions, num, nullptr, weights);
+    return write_curve(type, tag, step, walltime, totals);
+}
 
+// as `compute_curve`, `pr_curve` and `roc_curve` in VisualDL's
+// visualdl/component/base_component.py.
+void TensorBoardLogger::set_curve(const std::string &type,
+                                  const CurveTotals &totals, Record_Value *v) {
     const double _MINIMUM_COUNT = 1e-7;
 
-    for (size_t i = 0; i < num_thresholds; ++i) {
-        tn[i] = fp[0] - fp[i];
-        fn[i] = tp[0] - tp[i];
+    // reverse cumulative sums, the weights at or above each threshold.
+    vector<double> tp_buckets = totals.total_tp();
+    vector<double> fp_buckets = totals.total_fp();
+    size_t num_thresholds = tp_buckets.size();
+    vector<double> tp(num_thresholds), fp(num_thresholds);
+    double tp_sum = 0.0, fp_sum = 0.0;
+    for (size_t i = num_thresholds; i-- > 0;) {
+        tp[i] = tp_sum += tp_buckets[i];
+        fp[i] = fp_sum += fp_buckets[i];
     }
 
     if (type == "pr_curve") {
-        vector<double> precision(num_thresholds, 0.0);
-        vector<double> recall(num_thresholds, 0.0);
-        auto *pr_curve = new Record_PRCurve();
+        auto *pr_curve = v->mutable_pr_curve();
         for (size_t i = 0; i < num_thresholds; ++i) {
-            precision[i] =
-                double(tp[i]) / std::max(_MINIMUM_COUNT, double(tp[i] + fp[i]));
-            recall[i] =
-                double(tp[i]) / std::max(_MINIMUM_COUNT, double(tp[i] + fn[i]));
-            pr_curve->add_tp(tp[i]);
-            pr_curve->add_fp(fp[i]);
-            pr_curve->add_tn(tn[i]);
-            pr_curve->add_fn(fn[i]);
-            pr_curve->add_precision(precision[i]);
-            pr_curve->add_recall(recall[i]);
+            double tn = fp[0] - fp[i];
+            double fn = tp[0] - tp[i];
+            pr_curve->add_tp(static_cast<int64_t>(tp[i]));
+            pr_curve->add_fp(static_cast<int64_t>(fp[i]));
+            pr_curve->add_tn(static_cast<int64_t>(tn));
+            pr_curve->add_fn(static_cast<int64_t>(fn));
+            pr_curve->add_precision(tp[i] /
+                                    std::max(_MINIMUM_COUNT, tp[i] + fp[i]));
+            pr_curve->add_recall(tp[i] / std::max(_MINIMUM_COUNT, tp[i] + fn));
         }
-
-        auto *record = new Record();
-        auto v = record->add_values();
-        v->set_id(step);
-        v->set_tag(tag);
-        v->set_timestamp(walltime);
-        v->set_allocated_pr_curve(pr_curve);
-
-        return add_record(record);
     } else if (type == "roc_curve") {
-        vector<double> tpr(num_thresholds, 0.0);
-        vector<double> fpr(num_thresholds, 0.0);
-        auto *roc_curve = new Record_ROC_Curve();
+        auto *roc_curve = v->mutable_roc_curve();
         for (size_t i = 0; i < num_thresholds; ++i) {
-            tpr[i] =
-                double(tp[i]) / std::max(_MINIMUM_COUNT, double(tn[i] + fp[i]));
-            fpr[i] =
-                double(fp[i]) / std::max(_MINIMUM_COUNT, double(tn[i] + fp[i]));
-            roc_curve->add_tp(tp[i]);
-            roc_curve->add_fp(fp[i]);
-            roc_curve->add_tn(tn[i]);
-            roc_curve->add_fn(fn[i]);
-            roc_curve->add_tpr(tpr[i]);
-            roc_curve->add_fpr(fpr[i]);
+            double tn = fp[0] - fp[i];
+            double fn = tp[0] - tp[i];
+            roc_curve->add_tp(static_cast<int64_t>(tp[i]));
+            roc_curve->add_fp(static_cast<int64_t>(fp[i]));
+            roc_curve->add_tn(static_cast<int64_t>(tn));
+            roc_curve->add_fn(static_cast<int64_t>(fn));
+            roc_curve->add_tpr(tp[i] / std::max(_MINIMUM_COUNT, tp[i] + fn));
+            roc_curve->add_fpr(fp[i] / std::max(_MINIMUM_COUNT, fp[i] + tn));
         }
+    } else {
+        throw std::invalid_argument("curve type " + type +
+                                    " can not be recognized");
+    }
+}
+
+int TensorBoardLogger::write_curve(const std::string &type,
+                                   const std::string &tag, int step,
+                                   time_t walltime,
+                                   const CurveTotals &totals) {
+    auto *record = new_record();
+    auto v = record->add_values();
+    v->set_id(step);
+    v->set_tag(tag);
+    v->set_timestamp(walltime);
+    set_curve(type, totals, v);
+    return add_record(record);
+}
+
+// the curves of every class from one sweep over the rows, each task takes
+// a range of classes.  `label(row, c)` is the label of class c.
+template <typename Label>
+int TensorBoardLogger::add_class_curves(const std::string &type,
+                                        const std::string &tag_prefix,
+                                        const float *probs,
+                                        size_t num_samples,
+                                        size_t num_classes, Label label,
+                                        int step, int num_thresholds,
+                                        time_t walltime) {
+    if (type != "pr_curve" && type != "roc_curve") {
+        throw std::invalid_argument("curve type " + type +
+                                    " can not be recognized");
+    }
+    if (num_classes == 0) {
+        return 0;
+    }
+    if (walltime < 0) {
+        walltime = clock_.millis();
+    }
+    num_thresholds = curve_thresholds(num_thresholds);
+    const int last = num_thresholds - 1;
+    vector<CurveTotals> totals(num_classes, CurveTotals(num_thresholds));
+    size_t num_tasks = std::max<size_t>(
+        1, std::min(num_classes, histogram_tasks(num_samples * num_classes)));
+    const vector<int> bins = CurveTotals(num_thresholds).bins;
+    run_histogram_tasks(num_tasks, [&](size_t task) {
+        // as many classes at a time as keep their sums within 512KB, so
+        // they stay in L2 while the rows stream by, and at least a cache
+        // line of each row: 258 classes at 127 thresholds, 16 at 4096.
+        // the rows are read once per chunk.  the sums of a (class, bucket)
+        // still go row by row, in blocks as numpy's.
+        const size_t kClasses = std::max<size_t>(
+            16, (512 << 10) / (num_thresholds * 2 * sizeof(double)));
+        vector<double> sums(kClasses * num_thresholds * 2);
+        size_t end = num_classes * (task + 1) / num_tasks;
+        for (size_t first = num_classes * task / num_tasks; first < end;
+             first += kClasses) {
+            size_t count = std::min(kClasses, end - first);
+            for (size_t begin = 0; begin < num_samples;
+                 begin += CurveTotals::kBlock) {
+                size_t rows =
+                    std::min(num_samples - begin, CurveTotals::kBlock);
+                std::fill(sums.begin(), sums.end(), 0.0);
+                for (size_t row = begin; row < begin + rows; ++row) {
+                    const float *p = probs + row * num_classes + first;
+                    for (size_t c = 0; c < count; ++c) {
+                        double x = p[c] * double(last);
+                        if (!(x >= 0 && x < last + 1)) {
+                            continue;
+                        }
+                        double l = label(row, first + c);
+                        double *sum =
+                            &sums[(c * num_thresholds +
+                                   bins[static_cast<int>(x)]) * 2];
+                        sum[0] += l;
+                        sum[1] += 1.0 - l;
+                    }
+                }
+                for (size_t c = 0; c < count; ++c) {
+                    auto &t = totals[first + c];
+                    std::copy(sums.begin() + c * num_thresholds * 2,
+                              sums.begin() + (c + 1) * num_thresholds * 2,
+                              t.block.begin());
+                    t.block_fill = rows;
+                    if (rows == CurveTotals::kBlock) {
+                        t.close_block();
+                    }
+                }
+            }
+        }
+    });
 
-        auto *record = new Record();
+    auto *record = new_record();
+    for (size_t c = 0; c < num_classes; ++c) {
         auto v = record->add_values();
         v->set_id(step);
-        v->set_tag(tag);
+        v->set_tag(tag_prefix + "/" + std::to_string(c));
         v->set_timestamp(walltime);
-        v->set_allocated_roc_curve(roc_curve);
+        set_curve(type, totals[c], v);
+    }
+    return add_record(record);
+}
 
-        return add_record(record);
-    } else {
-        throw std::invalid_argument("curve type " + type +
-                                    " can not be recognized");
+int TensorBoardLogger::add_pr_curves(const std::string &tag_prefix,
+                                     const float *probs,
+                                     const int32_t *labels,
+                                     size_t num_samples, size_t num_classes,
+                                     int step, int num_thresholds,
+                                     time_t walltime) {
+    return add_class_curves(
+        "pr_curve", tag_prefix, probs, num_samples, num_classes,
+        [labels](size_t row, size_t c) {
+            return double(labels[row] == static_cast<int64_t>(c));
+        },
+        step, num_thresholds, walltime);
+}
+
+int TensorBoardLogger::add_roc_curves(const std::string &tag_prefix,
+                                      const float *probs,
+                                      const int32_t *labels,
+                                      size_t num_samples, size_t num_classes,
+                                      int step, int num_thresholds,
+                                      time_t walltime) {
+    return add_class_curves(
+        "roc_curve", tag_prefix, probs, num_samples, num_classes,
+        [labels](size_t row, size_t c) {
+            return double(labels[row] == static_cast<int64_t>(c));
+        },
+        step, num_thresholds, walltime);
+}
+
+int TensorBoardLogger::add_multi_label_pr_curves(
+    const std::string &tag_prefix, const float *probs, const float *labels,
+    size_t num_samples, size_t num_classes, int step, int num_thresholds,
+    time_t walltime) {
+    return add_class_curves(
+        "pr_curve", tag_prefix, probs, num_samples, num_classes,
+        [labels, num_classes](size_t row, size_t c) {
+            return double(labels[row * num_classes + c]);
+        },
+        step, num_thresholds, walltime);
+}
+
+int TensorBoardLogger::add_multi_label_roc_curves(
+    const std::string &tag_prefix, const float *probs, const float *labels,
+    size_t num_samples, size_t num_classes, int step, int num_thresholds,
+    time_t walltime) {
+    return add_class_curves(
+        "roc_curve", tag_prefix, probs, num_samples, num_classes,
+        [labels, num_classes](size_t row, size_t c) {
+            return double(labels[row * num_classes + c]);
+        },
+        step, num_thresholds, walltime);
+}
+
+CurveAccumulator::CurveAccumulator(TensorBoardLogger &logger,
+                                   int num_thresholds)
+    : logger_(logger),
+      totals_(TensorBoardLogger::curve_thresholds(num_thresholds)) {}
+
+int CurveAccumulator::emit_pr_curve(const std::string &tag, int step,
+                                    time_t walltime) {
+    return logger_.write_curve("pr_curve", tag, step,
+                               walltime < 0 ? logger_.clock_.millis()
+                                            : walltime,
+                               totals_);
+}
+
+int CurveAccumulator::emit_roc_curve(const std::string &tag, int step,
+                                     time_t walltime) {
+    return logger_.write_curve("roc_curve", tag, step,
+                               walltime < 0 ? logger_.clock_.millis()
+                                            : walltime,
+                               totals_);
+}
+
+int TensorBoardLogger::add_record(Record *record) {
+    if (writer_.joinable()) {
+        PendingWrite pending;
+        pending.record = record;
+        return enqueue(std::move(pending));
     }
+    int ret = write(*record);
+    release_message(record);
+    return ret;
 }
 
 int TensorBoardLogger::write(Record &record) {
-    string buf;
-    record.SerializeToString(&buf);
-    auto buf_len = static_cast<uint64_t>(buf.size());
+    auto &staging = current_staging();
+    std::unique_lock<std::mutex> lock(staging.mutex, std::defer_lock);
+    if (concurrent_) lock.lock();
 
-    ofs_->write((char *)&buf_len, sizeof(buf_len));
-    ofs_->write(buf.c_str(), buf.size());
+    size_t len = record.ByteSizeLong();
+    char *buf = begin_record(staging, len);
+    record.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t *>(buf));
+    return end_record(staging, len, record.values_size());
+}
+
+char *TensorBoardLogger::begin_record(Staging &staging, size_t len) {
+    auto &out = staging.out;
+    if (!record_batching_.enabled()) {
+        // frame the record in place: length, payload.
+        auto buf_len = static_cast<uint64_t>(len);
+        char *frame = out.reserve(sizeof(buf_len) + len);
+        memcpy(frame, &buf_len, sizeof(buf_len));
+        return frame + sizeof(buf_len);
+    }
 
-    ofs_->flush();
-    return 0;
+    if (!staging.batch_open) {
+        staging.batch_open = true;
+        staging.batch_start = out.size();
+        staging.batch_values = 0;
+        staging.batch_opened = std::chrono::steady_clock::now();
+        out.reserve(sizeof(uint64_t));
+        out.commit(sizeof(uint64_t));
+    }
+    // serialized records concatenate into a record holding all their values.
+    return out.reserve(len);
+}
+
+int TensorBoardLogger::end_record(Staging &staging, size_t len,
+                                  size_t num_values) {
+    auto &out = staging.out;
+    if (!record_batching_.enabled()) {
+        out.commit(sizeof(uint64_t) + len);
+        staging.records++;
+        return commit_record(staging);
+    }
+
+    out.commit(len);
+    staging.batch_values += num_values;
+
+    size_t batch_bytes = out.size() - staging.batch_start;
+    const auto &limits = record_batching_;
+    bool emit =
+        (limits.max_values > 0 && staging.batch_values >= limits.max_values) ||
+        (limits.max_bytes > 0 && batch_bytes >= limits.max_bytes) ||
+        (limits.max_millis > 0 &&
+         std::chrono::steady_clock::now() - staging.batch_opened >=
+             std::chrono::milliseconds(limits.max_millis)) ||
+        batch_bytes >= kMaxBufferedBytes;
+    if (!emit) {
+        return 0;
+    }
+    close_batch(staging);
+    return commit_record(staging);
+}
+
+void TensorBoardLogger::close_batch(Staging &staging) {
+    if (!staging.batch_open) {
+        return;
+    }
+    auto &out = staging.out;
+    auto buf_len = static_cast<uint64_t>(out.size() - staging.batch_start -
+                                         sizeof(uint64_t));
+    memcpy(out.data() + staging.batch_start, &buf_len, sizeof(buf_len));
+    staging.batch_open = false;
+    staging.records++;
 }
@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <random>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include "web_logger.h"
@@ -44,6 +47,9 @@ int test_log_image(TensorBoardLogger& logger) {
                         "TensorBoard", "Text");
     logger.add_image_tb("TensorBoard Audo Plugin", 1, image2, 1766, 814, 3,
                         "TensorBoard", "Audio");
+    logger.add_image_from_path_tb("TensorBoard Image Plugin", 1,
+                                  "./assets/image.png", 1502, 632, 3,
+                                  "TensorBoard", "Image");
 
     // add multiple images
     // FIXME This seems doesn't work anymore.
@@ -62,6 +68,9 @@ int test_log_audio(TensorBoardLogger& logger) {
         "Impact Moderato",
         "https://file-examples.com/index.php/sample-audio-files/"
         "sample-wav-download/");
+    logger.add_audio_from_path_tb(
+        "Audio Sample", 2, "./assets/file_example_WAV_1MG.wav", 8000, 2,
+        8000 * 16 * 2 * 33, "audio/wav");
 
     return 0;
 }
@@ -122,6 +131,83 @@ int test_log_embedding(TensorBoardLogger& logger) {
     return 0;
 }
 
+int test_crc32c() {
+    cout << "test crc32c" << endl;
+    // check value of the Castagnoli polynomial
+    assert(crc32c("123456789", 9) == 0xe3069283);
+
+    // the dispatched path (hardware where the CPU has SSE4.2) and the
+    // portable one agree with the byte-wise reference, and extending chunk
+    // by chunk gives the whole-buffer crc
+    default_random_engine generator;
+    vector<char> buf(3 * 8192 * 3 + 777);
+    for (auto& c : buf) c = static_cast<char>(generator());
+    for (size_t len : {0, 1, 7, 100, 3 * 256, 4000, 3 * 8192 + 5}) {
+        uint32_t whole = crc32c(buf.data() + 3, len);
+        assert(whole == crc32buf(buf.data() + 3, len));
+        assert(crc32c_portable_extend(0, buf.data() + 3, len) == whole);
+        uint32_t chunked = crc32c_extend(0, buf.data() + 3, len / 3);
+        chunked = crc32c_extend(chunked, buf.data() + 3 + len / 3,
+                                len - len / 3);
+        assert(chunked == whole);
+        chunked = crc32c_portable_extend(0, buf.data() + 3, len / 3);
+        chunked = crc32c_portable_extend(chunked, buf.data() + 3 + len / 3,
+                                         len - len / 3);
+        assert(chunked == whole);
+    }
+    return 0;
+}
+
+int test_bucket_index() {
+    cout << "test bucket index" << endl;
+    vector<double> limits;
+    for (double v = 1e-12; v < 1e20; v *= 1.1) limits.push_back(v);
+    limits.push_back(numeric_limits<double>::max());
+    size_t num_positive = limits.size();
+    for (size_t i = 0; i < num_positive; ++i) limits.push_back(-limits[i]);
+    sort(limits.begin(), limits.end());
+    BucketIndex buckets(limits);
+
+    // the limits themselves and their neighbours are where an off by one
+    // would show, the rest samples the whole range of doubles.
+    vector<double> values = {0.0, -0.0, INFINITY, -INFINITY, 5e-324};
+    for (double limit : limits) {
+        for (double v : {limit, nextafter(limit, 0.0),
+                         nextafter(limit, limit * 2)}) {
+            values.push_back(v);
+        }
+    }
+    default_random_engine generator;
+    normal_distribution<double> weights(0.0, 0.05);
+    for (int i = 0; i < 100000; ++i) {
+        uint64_t bits = (uint64_t(generator()) << 32) ^ generator();
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        if (v == v) values.push_back(v);
+        values.push_back(weights(generator));
+    }
+    vector<float> floats(values.begin(), values.end());
+
+    vector<uint32_t> indices(values.size());
+    vector<uint32_t> float_indices(values.size());
+    buckets(values.data(), values.size(), indices.data());
+    buckets(floats.data(), floats.size(), float_indices.data());
+    for (size_t i = 0; i < values.size(); ++i) {
+        // lower_bound, but +inf goes to the last bucket.
+        size_t expected = min<size_t>(
+            lower_bound(limits.begin(), limits.end(), values[i]) -
+                limits.begin(),
+            limits.size() - 1);
+        assert(buckets(values[i]) == expected);
+        assert(indices[i] == expected);
+        expected = lower_bound(limits.begin(), limits.end(), floats[i]) -
+                   limits.begin();
+        assert(float_indices[i] == min(expected, limits.size() - 1));
+    }
+    assert(buckets(NAN) == 0);
+    return 0;
+}
+
 int test_log(const char* log_file) {
     TensorBoardLogger logger(log_file);
 
@@ -135,6 +221,131 @@ int test_log(const char* log_file) {
     return 0;
 }
 
+// splits a log file into its serialized messages, checking tfrecord crcs.
+vector<string> read_log_messages(const string& log_file, bool tfrecord) {
+    auto content = read_binary_file(log_file);
+    vector<string> messages;
+    size_t offset = 0;
+    while (offset < content.size()) {
+        uint64_t len;
+        memcpy(&len, content.data() + offset, sizeof(len));
+        offset += sizeof(len) + (tfrecord ? sizeof(uint32_t) : 0);
+        messages.push_back(content.substr(offset, len));
+        if (tfrecord) {
+            uint32_t crc;
+            memcpy(&crc, content.data() + offset + len, sizeof(crc));
+            assert(crc == masked_crc32c(content.data() + offset, len));
+            offset += sizeof(crc);
+        }
+        offset += len;
+    }
+    return messages;
+}
+
+int test_log_async(const char* log_file) {
+    cout << "test log async" << endl;
+    LoggerOptions options;
+    options.async = true;
+    options.max_pending_records = 4;
+    {
+        TensorBoardLogger logger(log_file, false, "", options);
+
+        default_random_engine generator;
+        normal_distribution<double> default_distribution(0, 1.0);
+        for (int i = 0; i < 100; ++i) {
+            logger.add_scalar_tb("async scalar", i,
+                                 default_distribution(generator));
+        }
+        logger.flush();
+        for (int i = 100; i < 200; ++i) {
+            logger.add_scalar_tb("async scalar", i,
+                                 default_distribution(generator));
+        }
+        // destructor drains the rest of the queue.
+    }
+
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == 200);
+    for (size_t i = 0; i < events.size(); ++i) {
+        Event event;
+        assert(event.ParseFromString(events[i]));
+        assert(event.step() == int64_t(i));
+        assert(event.summary().value(0).tag() == "async scalar");
+    }
+    return 0;
+}
+
+int test_log_flush_policy(const char* log_file) {
+    cout << "test log flush policy" << endl;
+    LoggerOptions options;
+    options.flush_policy = FlushPolicy::every_bytes(4096);
+    TensorBoardLogger logger(log_file, false, "", options);
+
+    for (int i = 0; i < 1000; ++i) {
+        logger.add_scalar_tb("buffered scalar", i, 0.1 * i);
+    }
+    // the tail of the records is still short of 4096 bytes.
+    size_t written = read_log_messages(log_file, true).size();
+    assert(written > 0 && written < 1000);
+    int ret = logger.flush();
+    assert(ret == 0);
+    assert(read_log_messages(log_file, true).size() == 1000);
+
+    return 0;
+}
+
+int test_log_concurrent(const char* log_file) {
+    cout << "test log concurrent" << endl;
+    LoggerOptions options;
+    options.concurrent = true;
+    options.flush_policy = FlushPolicy::every_bytes(4096);
+    {
+        // the first histograms of a fresh logger, from several threads.
+        TensorBoardLogger logger(log_file, false, "", options);
+        vector<thread> histograms;
+        for (int t = 0; t < 4; ++t) {
+            histograms.emplace_back([&logger, t] {
+                vector<float> values(1000, 1.0f * t);
+                logger.add_histogram_tb("histogram_" + to_string(t), 0,
+                                        values);
+            });
+        }
+        for (auto& histogram : histograms) histogram.join();
+    }
+    assert(read_log_messages(log_file, true).size() == 4);
+
+    TensorBoardLogger logger(log_file, false, "", options);
+    vector<thread> producers;
+    for (int t = 0; t < 4; ++t) {
+        producers.emplace_back([&logger, t] {
+            string tag = "producer_" + to_string(t);
+            for (int i = 0; i < 1000; ++i) {
+                logger.add_scalar_tb(tag, i, 1.0 * t * i);
+            }
+        });
+    }
+    for (auto& producer : producers) producer.join();
+    logger.flush();
+
+    // whole records only, each producer's in the order it added them.
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == 4000);
+    vector<int> next_step(4, 0);
+    for (const auto& bytes : events) {
+        Event event;
+        assert(event.ParseFromString(bytes));
+        const auto& tag = event.summary().value(0).tag();
+        assert(tag.compare(0, 9, "producer_") == 0);
+        int t = stoi(tag.substr(9));
+        assert(t >= 0 && t < 4);
+        assert(event.step() == next_step[t]);
+        ++next_step[t];
+    }
+    for (int steps : next_step) assert(steps == 1000);
+
+    return 0;
+}
+
 int test_log_vdl_scalar(TensorBoardLogger& logger,
                         default_random_engine& generator,
                         normal_distribution<double>& default_distribution) {
@@ -145,6 +356,802 @@ int test_log_vdl_scalar(TensorBoardLogger& logger,
     return 0;
 }
 
+int test_log_from_path_encoding(const char* log_file) {
+    cout << "test log from path encoding" << endl;
+    // mapped files are framed by hand around their bytes, small ones copied
+    // and large ones written from the mapping.  either way the event must
+    // match protobuf to the byte, and the one from the bytes in memory.
+    default_random_engine generator;
+    vector<string> contents;
+    for (size_t size : {1000, 100000}) {
+        string content(size, '\0');
+        for (auto& c : content) c = static_cast<char>(generator());
+        string path = string(log_file) + ".payload" + to_string(size);
+        ofstream(path, ios::binary).write(content.data(), content.size());
+        contents.push_back(content);
+    }
+    {
+        TensorBoardLogger logger(log_file);
+        for (const auto& content : contents) {
+            string path = string(log_file) + ".payload" +
+                          to_string(content.size());
+            logger.add_image_from_path_tb("image", 1, path, 4, 5, 3, "shown",
+                                          "described");
+            logger.add_image_tb("image", 1, content, 4, 5, 3, "shown",
+                                "described");
+            logger.add_audio_from_path_tb("audio", 2, path, 44100, 2, 700,
+                                          "audio/wav", "heard", "described");
+            logger.add_audio_tb("audio", 2, content, 44100, 2, 700,
+                                "audio/wav", "heard", "described");
+        }
+    }
+
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == 8);
+    for (size_t i = 0; i < events.size(); i += 2) {
+        Event from_path, from_memory;
+        assert(from_path.ParseFromString(events[i]));
+        assert(from_path.SerializeAsString() == events[i]);
+        assert(from_path.summary().value(0).has_metadata());
+        assert(from_memory.ParseFromString(events[i + 1]));
+        from_memory.set_wall_time(from_path.wall_time());
+        assert(from_memory.SerializeAsString() == events[i]);
+    }
+    return 0;
+}
+
+int test_log_scalar_encoding(const char* log_file, const char* log_dir) {
+    cout << "test log scalar encoding" << endl;
+    // scalars are encoded by hand, they must match protobuf to the byte.
+    vector<int> steps = {0, 1, -1, 300, numeric_limits<int>::max()};
+    vector<double> values = {0.0, -0.0, 1.5, 1e30, NAN, -INFINITY};
+    vector<string> tags = {"", "scalar", string(200, 't')};
+    size_t num_scalars = steps.size() * values.size() * tags.size();
+    string vdl_log_file;
+    {
+        TensorBoardLogger tb_logger(log_file);
+        TensorBoardLogger vdl_logger(log_dir, true, ".encoding");
+        vdl_log_file = vdl_logger.log_file();
+        for (auto step : steps) {
+            for (auto value : values) {
+                for (const auto& tag : tags) {
+                    tb_logger.add_scalar_tb(tag, step, value);
+                    vdl_logger.add_scalar(tag, step, value, step == 1 ? 0 : -1);
+                }
+            }
+        }
+    }
+
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == num_scalars);
+    for (const auto& bytes : events) {
+        Event event;
+        assert(event.ParseFromString(bytes));
+        assert(event.SerializeAsString() == bytes);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == num_scalars);
+    for (const auto& bytes : records) {
+        Record record;
+        assert(record.ParseFromString(bytes));
+        assert(record.SerializeAsString() == bytes);
+    }
+    return 0;
+}
+
+int test_log_scalars(const char* log_file, const char* log_dir) {
+    cout << "test log scalars" << endl;
+    vector<pair<string, double>> metrics;
+    vector<string> tags;
+    vector<double> values;
+    for (int i = 0; i < 50; ++i) {
+        metrics.emplace_back("metric_" + to_string(i), 0.5 * i);
+        tags.push_back(metrics.back().first);
+        values.push_back(metrics.back().second);
+    }
+    string vdl_log_file;
+    {
+        TensorBoardLogger tb_logger(log_file);
+        TensorBoardLogger vdl_logger(log_dir, true, ".scalars");
+        vdl_log_file = vdl_logger.log_file();
+        for (int step = 0; step < 10; ++step) {
+            tb_logger.add_scalars_tb(step, metrics);
+            tb_logger.add_scalars_tb(step, tags.data(), values.data(),
+                                     tags.size());
+            vdl_logger.add_scalars(step, metrics);
+            vdl_logger.add_scalars(step, tags.data(), values.data(),
+                                   tags.size());
+        }
+    }
+
+    // one event / record per call, holding all the values.
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == 20);
+    for (const auto& bytes : events) {
+        Event event;
+        assert(event.ParseFromString(bytes));
+        assert(event.SerializeAsString() == bytes);
+        assert(event.summary().value_size() == 50);
+        assert(event.summary().value(49).tag() == "metric_49");
+        assert(event.summary().value(49).simple_value() == 24.5f);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == 20);
+    for (const auto& bytes : records) {
+        Record record;
+        assert(record.ParseFromString(bytes));
+        assert(record.SerializeAsString() == bytes);
+        assert(record.values_size() == 50);
+        assert(record.values(49).tag() == "metric_49");
+        assert(record.values(49).value() == 24.5f);
+    }
+    return 0;
+}
+
+int test_log_tag_handles(const char* log_file, const char* log_dir) {
+    cout << "test log tag handles" << endl;
+    string vdl_log_file;
+    {
+        TensorBoardLogger tb_logger(log_file);
+        TensorBoardLogger vdl_logger(log_dir, true, ".handles");
+        vdl_log_file = vdl_logger.log_file();
+        string long_tag = "a/rather/long/tag/that/does/not/fit/in/sso/" +
+                          string(200, 'x');
+        auto tb_tag = tb_logger.register_tag(long_tag);
+        auto vdl_tag = vdl_logger.register_tag(long_tag);
+        assert(vdl_logger.register_tag(long_tag).tag() == vdl_tag.tag());
+
+        vector<double> values(1000);
+        for (size_t i = 0; i < values.size(); ++i) values[i] = i * 0.5 - 100;
+        for (int step = 0; step < 3; ++step) {
+            tb_logger.add_scalar_tb(long_tag, step, step * 0.5);
+            tb_logger.add_scalar_tb(tb_tag, step, step * 0.5);
+            tb_logger.add_histogram_tb(long_tag, step, values);
+            tb_logger.add_histogram_tb(tb_tag, step, values);
+            vdl_logger.add_scalar(long_tag, step, step * 0.5, 1000);
+            vdl_logger.add_scalar(vdl_tag, step, step * 0.5, 1000);
+        }
+
+        // a default handle names no tag, and logs nothing.
+        TagHandle none;
+        assert(!none.valid());
+        int thrown = 0;
+        try {
+            tb_logger.add_scalar_tb(none, 3, 1.0);
+        } catch (const invalid_argument&) {
+            ++thrown;
+        }
+        try {
+            tb_logger.add_histogram_tb(none, 3, values);
+        } catch (const invalid_argument&) {
+            ++thrown;
+        }
+        try {
+            vdl_logger.add_scalar(none, 3, 1.0);
+        } catch (const invalid_argument&) {
+            ++thrown;
+        }
+        try {
+            vdl_logger.add_histogram(none, 3, 10, values);
+        } catch (const invalid_argument&) {
+            ++thrown;
+        }
+        assert(thrown == 4);
+    }
+
+    // every call through a handle matches the one before it to the byte,
+    // but for the wall time.
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == 12);
+    for (size_t i = 0; i < events.size(); i += 2) {
+        Event by_tag, by_handle;
+        assert(by_tag.ParseFromString(events[i]));
+        assert(by_handle.ParseFromString(events[i + 1]));
+        assert(by_handle.SerializeAsString() == events[i + 1]);
+        by_handle.set_wall_time(by_tag.wall_time());
+        assert(by_handle.SerializeAsString() == events[i]);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == 6);
+    for (size_t i = 0; i < records.size(); i += 2) {
+        assert(records[i] == records[i + 1]);
+    }
+    return 0;
+}
+
+int test_log_wall_clock(const char* log_file, const char* log_dir) {
+    cout << "test log wall clock" << endl;
+    LoggerOptions options;
+    options.wall_clock = WallClock::kPrecise;
+    string vdl_log_file;
+    {
+        TensorBoardLogger tb_logger(log_file, false, "", options);
+        TensorBoardLogger vdl_logger(log_dir, true, ".clock", options);
+        vdl_log_file = vdl_logger.log_file();
+        for (int step = 0; step < 10; ++step) {
+            tb_logger.add_scalar_tb("clock", step, 1.0);
+            vdl_logger.add_scalar("clock", step, 1.0);
+            this_thread::sleep_for(chrono::milliseconds(3));
+        }
+    }
+
+    // sub-second wall times, in order.
+    double last_wall_time = 0;
+    bool fractional = false;
+    for (const auto& bytes : read_log_messages(log_file, true)) {
+        Event event;
+        assert(event.ParseFromString(bytes));
+        assert(event.wall_time() >= last_wall_time);
+        fractional |= event.wall_time() != floor(event.wall_time());
+        last_wall_time = event.wall_time();
+    }
+    assert(fractional);
+    int64_t last_timestamp = 0;
+    set<int64_t> timestamps;
+    for (const auto& bytes : read_log_messages(vdl_log_file, false)) {
+        Record record;
+        assert(record.ParseFromString(bytes));
+        assert(record.values(0).timestamp() >= last_timestamp);
+        last_timestamp = record.values(0).timestamp();
+        timestamps.insert(last_timestamp);
+    }
+    assert(timestamps.size() == 10);
+    return 0;
+}
+
+int test_log_resume(const char* log_file, const char* log_dir) {
+    cout << "test log resume" << endl;
+    string vdl_log_file;
+    {
+        TensorBoardLogger tb_logger(log_file);
+        TensorBoardLogger vdl_logger(log_dir, true, ".resume");
+        vdl_log_file = vdl_logger.log_file();
+        for (int step = 0; step < 10; ++step) {
+            tb_logger.add_scalar_tb("resume", step, 1.0 * step);
+            vdl_logger.add_scalar("resume", step, 1.0 * step);
+            if (step == 4) {
+                // an empty record is a valid one, not a torn tail.
+                vdl_logger.flush();
+                ofstream(vdl_log_file, ios::binary | ios::app)
+                    .write("\0\0\0\0\0\0\0\0", 8);
+            }
+        }
+    }
+    // a preempted run leaves half a record behind.
+    auto tb_tail = read_log_messages(log_file, true).back();
+    ofstream(log_file, ios::binary | ios::app).write(tb_tail.data(), 7);
+    ofstream(vdl_log_file, ios::binary | ios::app).write("\x20\0\0\0", 4);
+
+    LoggerOptions options;
+    options.resume = true;
+    {
+        TensorBoardLogger tb_logger(log_file, false, "", options);
+        TensorBoardLogger vdl_logger(log_dir, true, ".resume", options);
+        assert(vdl_logger.log_file() == vdl_log_file);
+        for (int step = 10; step < 20; ++step) {
+            tb_logger.add_scalar_tb("resume", step, 1.0 * step);
+            vdl_logger.add_scalar("resume", step, 1.0 * step);
+        }
+    }
+
+    auto events = read_log_messages(log_file, true);
+    assert(events.size() == 20);
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == 21);
+    assert(records[5].empty());
+    records.erase(records.begin() + 5);
+    for (int step = 0; step < 20; ++step) {
+        Event event;
+        assert(event.ParseFromString(events[step]));
+        assert(event.step() == step);
+        Record record;
+        assert(record.ParseFromString(records[step]));
+        assert(record.values(0).id() == step);
+    }
+    return 0;
+}
+
+int test_log_rotation(const char* log_file, const char* log_dir) {
+    cout << "test log rotation" << endl;
+    LoggerOptions options;
+    options.rotation.max_records = 4;
+    // a VisualDL batch is one record.
+    options.record_batching.max_values = 3;
+    vector<string> tb_files;
+    vector<string> vdl_files;
+    {
+        TensorBoardLogger tb_logger(log_file, false, "", options);
+        TensorBoardLogger vdl_logger(log_dir, true, ".rotation", options);
+        auto track = [&]() {
+            if (tb_files.empty() || tb_files.back() != tb_logger.log_file()) {
+                tb_files.push_back(tb_logger.log_file());
+            }
+            if (vdl_files.empty() ||
+                vdl_files.back() != vdl_logger.log_file()) {
+                vdl_files.push_back(vdl_logger.log_file());
+            }
+        };
+        vdl_logger.add_meta("meta_data_tag", "rotation");
+        for (int step = 0; step < 30; ++step) {
+            tb_logger.add_scalar_tb("rotation", step, 1.0 * step);
+            vdl_logger.add_scalar("rotation", step, 1.0 * step);
+            track();
+        }
+        tb_logger.close();
+        vdl_logger.close();
+        track();
+    }
+    assert(tb_files[0] == log_file);
+    assert(tb_files.size() == 8);
+
+    // every record made it, in order, and none is split across files.
+    int step = 0;
+    for (size_t i = 0; i < tb_files.size(); ++i) {
+        auto events = read_log_messages(tb_files[i], true);
+        assert(!events.empty() && events.size() <= 4);
+        assert(i == 0 || tb_files[i] > tb_files[i - 1]);
+        for (const auto& message : events) {
+            Event event;
+            assert(event.ParseFromString(message));
+            assert(event.step() == step++);
+        }
+    }
+    assert(step == 30);
+
+    step = 0;
+    for (size_t i = 0; i < vdl_files.size(); ++i) {
+        auto records = read_log_messages(vdl_files[i], false);
+        assert(records.size() > 1 && records.size() <= 4);
+        assert(i == 0 || vdl_files[i] > vdl_files[i - 1]);
+        for (size_t j = 0; j < records.size(); ++j) {
+            Record record;
+            assert(record.ParseFromString(records[j]));
+            for (const auto& value : record.values()) {
+                if (value.has_meta_data()) {
+                    // repeated at the start of every file.
+                    assert(j == 0);
+                    assert(value.meta_data().display_name() == "rotation");
+                } else {
+                    assert(value.id() == step++);
+                }
+            }
+        }
+    }
+    assert(step == 30);
+
+    // a crash leaves the pre-opened next file behind, empty, and resuming
+    // goes on with the last file written to instead.
+    string tb_preopened = string(log_file) + ".9999999999";
+    string vdl_preopened =
+        string(log_dir) + "/vdlrecords.9999999999.log.rotation";
+    ofstream(tb_preopened, ios::binary);
+    ofstream(vdl_preopened, ios::binary);
+    LoggerOptions resume_options;
+    resume_options.resume = true;
+    {
+        TensorBoardLogger tb_logger(log_file, false, "", resume_options);
+        TensorBoardLogger vdl_logger(log_dir, true, ".rotation",
+                                     resume_options);
+        assert(tb_logger.log_file() == tb_files.back());
+        assert(vdl_logger.log_file() == vdl_files.back());
+    }
+    return 0;
+}
+
+int test_log_parallel_histograms(const char* log_file, const char* log_dir) {
+    cout << "test log parallel histograms" << endl;
+    // not a multiple of the block size, with NaN and inf, some of them
+    // where the range of a task starts.
+    default_random_engine generator;
+    normal_distribution<float> weights(0.0f, 0.05f);
+    vector<float> tb_values(5 * kHistogramBlock + 123);
+    for (auto& v : tb_values) v = weights(generator);
+    tb_values[kHistogramBlock] = NAN;
+    tb_values[3 * kHistogramBlock + 7] = -INFINITY;
+    vector<double> vdl_values(tb_values.begin(), tb_values.end());
+    for (auto& v : vdl_values) {
+        if (!isfinite(v)) v = 0.5;
+    }
+    vdl_values[vdl_values.size() / 4] = NAN;
+    vdl_values[vdl_values.size() / 4 + 1] = -1.0;
+    vdl_values[vdl_values.size() / 3] = NAN;
+    vdl_values[vdl_values.size() / 3 + 1] = 1.0;
+
+    vector<LoggerOptions> options(3);
+    options[1].histogram_parallelism.threads = 4;
+    options[1].histogram_parallelism.min_values = 1;
+    options[2].histogram_parallelism.threads = 3;
+    options[2].histogram_parallelism.min_values = 1;
+    options[2].histogram_parallelism.executor =
+        [](size_t num_tasks, const function<void(size_t)>& task) {
+            vector<thread> threads;
+            for (size_t i = 0; i < num_tasks; ++i) {
+                threads.emplace_back(task, i);
+            }
+            for (auto& t : threads) t.join();
+        };
+
+    vector<string> tb_histograms, vdl_histograms;
+    for (size_t i = 0; i < options.size(); ++i) {
+        string vdl_log_file;
+        {
+            TensorBoardLogger tb_logger(log_file, false, "", options[i]);
+            TensorBoardLogger vdl_logger(log_dir, true, ".parallel",
+                                         options[i]);
+            vdl_log_file = vdl_logger.log_file();
+            tb_logger.add_histogram_tb("parallel", 0, tb_values);
+            vdl_logger.add_histogram("parallel", 0, 30, vdl_values.data(),
+                                     vdl_values.size());
+        }
+        Event event;
+        assert(event.ParseFromString(read_log_messages(log_file, true)[0]));
+        const auto& histo = event.summary().value(0).histo();
+        assert(histo.num() == tb_values.size());
+        assert(histo.min() == -INFINITY);
+        tb_histograms.push_back(histo.SerializeAsString());
+        Record record;
+        assert(record.ParseFromString(
+            read_log_messages(vdl_log_file, false)[0]));
+        vdl_histograms.push_back(
+            record.values(0).histogram().SerializeAsString());
+    }
+    for (size_t i = 1; i < options.size(); ++i) {
+        assert(tb_histograms[i] == tb_histograms[0]);
+        assert(vdl_histograms[i] == vdl_histograms[0]);
+    }
+    return 0;
+}
+
+int test_log_histogram_accumulator(const char* log_file, const char* log_dir) {
+    cout << "test log histogram accumulator" << endl;
+    // shards that straddle block boundaries, against one array.
+    default_random_engine generator;
+    normal_distribution<double> weights(0.0, 0.05);
+    vector<double> values(3 * kHistogramBlock + 77);
+    for (auto& v : values) v = weights(generator);
+    values[5] = NAN;
+    values[kHistogramBlock + 9] = 100.0;
+    const size_t shards[] = {1000, kHistogramBlock, kHistogramBlock + 5, 0};
+    {
+        TensorBoardLogger logger(log_file, false);
+        logger.add_histogram_tb("accumulated", 0, values);
+        HistogramAccumulator accumulator(logger);
+        size_t offset = 0;
+        for (size_t shard : shards) {
+            accumulator.update(values.data() + offset, shard);
+            offset += shard;
+        }
+        accumulator.update(values.data() + offset, values.size() - offset);
+        assert(accumulator.num() == values.size());
+        accumulator.emit("accumulated", 0);
+    }
+    Event whole, accumulated;
+    auto events = read_log_messages(log_file, true);
+    assert(whole.ParseFromString(events[0]));
+    assert(accumulated.ParseFromString(events[1]));
+    assert(whole.summary().value(0).histo().SerializeAsString() ==
+           accumulated.summary().value(0).histo().SerializeAsString());
+
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".accumulated");
+        vdl_log_file = logger.log_file();
+        HistogramAccumulator accumulator(logger, 4, 0.0, 1.0);
+        accumulator.update(vector<float>{-3.0f, 0.1f, 0.25f, NAN});
+        accumulator.update(vector<double>{0.6, 0.99, 1.0, 7.0});
+        accumulator.emit("accumulated", 1, 0);
+        accumulator.reset();
+        accumulator.update(vector<int>{0, 1});
+        accumulator.emit("accumulated", 2, 0);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    Record record;
+    assert(record.ParseFromString(records[0]));
+    const auto& hist = record.values(0).histogram();
+    const double counts[] = {2, 1, 1, 3};
+    assert(hist.hist_size() == 4 && hist.bin_edges_size() == 5);
+    for (int i = 0; i < 4; ++i) {
+        assert(hist.hist(i) == counts[i]);
+        assert(hist.bin_edges(i) == 0.25 * i);
+    }
+    assert(hist.bin_edges(4) == 1.0);
+    assert(record.ParseFromString(records[1]));
+    assert(record.values(0).histogram().hist(0) == 1);
+    assert(record.values(0).histogram().hist(3) == 1);
+    return 0;
+}
+
+int test_log_vdl_histogram_bins(const char* log_dir) {
+    cout << "test vdl log histogram bins" << endl;
+    default_random_engine generator;
+    uniform_real_distribution<float> distribution(-3.0f, 5.0f);
+    vector<float> finite(100003);
+    for (auto& v : finite) v = distribution(generator);
+    // values on the edges, wherever they end up.
+    for (int i = 0; i < 100; ++i) finite[i] = -3.0f + 0.5f * (i % 17);
+    vector<float> values = finite;
+    values.insert(values.end(), {NAN, INFINITY, -INFINITY, NAN});
+
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".bins");
+        vdl_log_file = logger.log_file();
+        logger.add_histogram("bins", 0, 16, values, 0);
+        logger.add_histogram("bins", 1, 16, finite, 0);
+        logger.add_histogram("bins", 2, 16, vector<double>(10, 2.5), 0);
+        logger.add_histogram("bins", 3, 16, vector<double>{NAN}, 0);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    Record record, finite_record;
+    assert(record.ParseFromString(records[0]));
+    assert(finite_record.ParseFromString(records[1]));
+    const auto& hist = record.values(0).histogram();
+    const auto& finite_hist = finite_record.values(0).histogram();
+    // NaN and inf leave the edges alone.
+    assert(hist.bin_edges_size() == 17);
+    for (int i = 0; i < 17; ++i) {
+        assert(hist.bin_edges(i) == finite_hist.bin_edges(i));
+    }
+    // numpy.histogram over the edges, plus inf clamped to the ends.
+    vector<double> expected(16, 0);
+    for (float v : values) {
+        if (isnan(v)) continue;
+        size_t bin = upper_bound(hist.bin_edges().begin(),
+                                 hist.bin_edges().end(), double(v)) -
+                     hist.bin_edges().begin();
+        bin = bin > 0 ? bin - 1 : 0;
+        expected[bin < 16 ? bin : 15]++;
+    }
+    for (int i = 0; i < 16; ++i) {
+        assert(hist.hist(i) == expected[i]);
+    }
+    for (size_t i = 2; i < records.size(); ++i) {
+        assert(record.ParseFromString(records[i]));
+        double total = 0;
+        for (double count : record.values(0).histogram().hist()) {
+            total += count;
+        }
+        assert(total == (i == 2 ? 10 : 0));
+    }
+    return 0;
+}
+
+int test_log_sampled_histograms(const char* log_file, const char* log_dir) {
+    cout << "test log sampled histograms" << endl;
+    default_random_engine generator;
+    lognormal_distribution<double> distribution(0.0, 1.0);
+    vector<double> values(1000003);
+    for (auto& v : values) v = distribution(generator);
+    double exact_sum = 0;
+    for (double v : values) exact_sum += v;
+
+    HistogramSampling strided, reservoir;
+    strided.max_values = reservoir.max_values = 20000;
+    reservoir.method = HistogramSampling::kReservoir;
+    reservoir.seed = 7;
+    for (const auto& sampling : {strided, reservoir}) {
+        auto indices = sample_indices(values.size(), sampling);
+        assert(indices.size() == sampling.max_values);
+        assert(is_sorted(indices.begin(), indices.end()));
+        assert(adjacent_find(indices.begin(), indices.end()) == indices.end());
+        assert(indices.back() < values.size());
+        assert(indices == sample_indices(values.size(), sampling));
+    }
+    assert(sample_indices(10, strided).size() == 10);
+    HistogramSampling none;
+    none.max_values = 0;
+    bool thrown = false;
+    try {
+        sample_indices(10, none);
+    } catch (const invalid_argument&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // a sketch of two halves is the sketch of the whole.
+    DDSketch sketch(0.01), first(0.01), second(0.01);
+    sketch.add(values.data(), values.size());
+    first.add(values.data(), values.size() / 2);
+    second.add(values.data() + values.size() / 2,
+               values.size() - values.size() / 2);
+    first.merge(second);
+    assert(first.num() == sketch.num() && first.count() == sketch.count());
+    auto sorted = values;
+    sort(sorted.begin(), sorted.end());
+    for (double q : {0.0, 0.01, 0.25, 0.5, 0.9, 0.999, 1.0}) {
+        double exact = sorted[size_t(q * (sorted.size() - 1))];
+        assert(fabs(sketch.quantile(q) - exact) <= 0.01 * exact);
+        assert(first.quantile(q) == sketch.quantile(q));
+    }
+
+    {
+        TensorBoardLogger logger(log_file, false);
+        logger.add_histogram_tb("sampled", 0, values, strided);
+        logger.add_histogram_tb("sampled", 1, values, reservoir);
+        logger.add_histogram_tb("sketch", 0, sketch);
+    }
+    auto events = read_log_messages(log_file, true);
+    for (int i = 0; i < 3; ++i) {
+        Event event;
+        assert(event.ParseFromString(events[i]));
+        const auto& histo = event.summary().value(0).histo();
+        double total = 0;
+        for (double count : histo.bucket()) total += count;
+        assert(histo.num() == values.size());
+        assert(fabs(total - values.size()) < 1e-6 * values.size());
+        assert(fabs(histo.sum() - exact_sum) < 0.05 * exact_sum);
+    }
+
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".sampled");
+        vdl_log_file = logger.log_file();
+        logger.add_histogram("sampled", 0, 30, values, reservoir);
+        logger.add_histogram("sketch", 0, sketch);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    for (int i = 0; i < 2; ++i) {
+        Record record;
+        assert(record.ParseFromString(records[i]));
+        const auto& hist = record.values(0).histogram();
+        assert(hist.bin_edges_size() == hist.hist_size() + 1);
+        double total = 0;
+        for (double count : hist.hist()) total += count;
+        assert(fabs(total - values.size()) < 1e-6 * values.size());
+    }
+    return 0;
+}
+
+template <typename T>
+void add_any_histogram(TensorBoardLogger& logger, bool vdl, const string& tag,
+                       const T* value, size_t num) {
+    if (vdl) {
+        logger.add_histogram(tag, 0, 30, value, num, 0);
+    } else {
+        logger.add_histogram_tb(tag, 0, value, num);
+    }
+}
+
+int test_log_low_precision_histograms(const char* log_file,
+                                      const char* log_dir) {
+    cout << "test log low precision histograms" << endl;
+    // every half, F16C or not.
+    vector<uint16_t> all_bits(1 << 16);
+    for (size_t i = 0; i < all_bits.size(); ++i) all_bits[i] = i;
+    vector<float> converted(all_bits.size());
+    to_float_fp16(all_bits.data(), all_bits.size() - 3, converted.data());
+    for (size_t i = 0; i < all_bits.size() - 3; ++i) {
+        float expected = float16_value(all_bits[i]);
+        assert(memcmp(&converted[i], &expected, sizeof(float)) == 0);
+    }
+    to_float_bf16(all_bits.data(), all_bits.size() - 3, converted.data());
+    for (size_t i = 0; i < all_bits.size() - 3; ++i) {
+        float expected = bfloat16_value(all_bits[i]);
+        assert(memcmp(&converted[i], &expected, sizeof(float)) == 0);
+    }
+
+    // the same histograms as from the values upcast to float or double.
+    default_random_engine generator;
+    uniform_int_distribution<int> bits(0, 0xffff), bytes(-128, 127);
+    vector<uint16_t> half_bits(100003);
+    for (auto& b : half_bits) b = bits(generator);
+    vector<int8_t> signed_bytes(200001);
+    for (auto& b : signed_bytes) b = bytes(generator);
+    vector<uint8_t> unsigned_bytes(signed_bytes.begin(), signed_bytes.end());
+    vector<float> fp16_floats, bf16_floats;
+    for (auto b : half_bits) {
+        fp16_floats.push_back(float16_value(b));
+        bf16_floats.push_back(bfloat16_value(b));
+    }
+    vector<double> signed_doubles(signed_bytes.begin(), signed_bytes.end());
+    vector<double> unsigned_doubles(unsigned_bytes.begin(),
+                                    unsigned_bytes.end());
+
+    string vdl_log_file;
+    {
+        TensorBoardLogger tb_logger(log_file, false);
+        TensorBoardLogger vdl_logger(log_dir, true, ".low_precision");
+        vdl_log_file = vdl_logger.log_file();
+        for (auto* logger : {&tb_logger, &vdl_logger}) {
+            bool vdl = logger == &vdl_logger;
+            if (vdl) {
+                logger->add_histogram_fp16("fp16", 0, 30, half_bits.data(),
+                                           half_bits.size(), 0);
+            } else {
+                logger->add_histogram_tb_fp16("fp16", 0, half_bits.data(),
+                                              half_bits.size());
+            }
+            add_any_histogram(*logger, vdl, "fp16", fp16_floats.data(),
+                              fp16_floats.size());
+            if (vdl) {
+                logger->add_histogram_bf16("bf16", 0, 30, half_bits.data(),
+                                           half_bits.size(), 0);
+            } else {
+                logger->add_histogram_tb_bf16("bf16", 0, half_bits.data(),
+                                              half_bits.size());
+            }
+            add_any_histogram(*logger, vdl, "bf16", bf16_floats.data(),
+                              bf16_floats.size());
+            add_any_histogram(*logger, vdl, "int8", signed_bytes.data(),
+                              signed_bytes.size());
+            add_any_histogram(*logger, vdl, "int8", signed_doubles.data(),
+                              signed_doubles.size());
+            add_any_histogram(*logger, vdl, "uint8", unsigned_bytes.data(),
+                              unsigned_bytes.size());
+            add_any_histogram(*logger, vdl, "uint8", unsigned_doubles.data(),
+                              unsigned_doubles.size());
+        }
+        // halves in pieces, as one array of their floats.
+        HistogramAccumulator halves(tb_logger), floats(tb_logger);
+        size_t half = half_bits.size() / 2;
+        halves.update_bf16(half_bits.data(), half);
+        halves.update_bf16(half_bits.data() + half, half_bits.size() - half);
+        floats.update(bf16_floats);
+        halves.emit("bf16 pieces", 0);
+        floats.emit("bf16 pieces", 0);
+    }
+    auto events = read_log_messages(log_file, true);
+    auto records = read_log_messages(vdl_log_file, false);
+    for (int i = 0; i < 8; i += 2) {
+        Event low, upcast;
+        assert(low.ParseFromString(events[i]));
+        assert(upcast.ParseFromString(events[i + 1]));
+        assert(low.summary().value(0).histo().SerializeAsString() ==
+               upcast.summary().value(0).histo().SerializeAsString());
+        Record low_record, upcast_record;
+        assert(low_record.ParseFromString(records[i]));
+        assert(upcast_record.ParseFromString(records[i + 1]));
+        assert(low_record.values(0).histogram().SerializeAsString() ==
+               upcast_record.values(0).histogram().SerializeAsString());
+    }
+    Event pieces, whole;
+    assert(pieces.ParseFromString(events[8]));
+    assert(whole.ParseFromString(events[9]));
+    assert(pieces.summary().value(0).histo().SerializeAsString() ==
+           whole.summary().value(0).histo().SerializeAsString());
+    return 0;
+}
+
+int test_log_vdl_batching(const char* log_dir) {
+    cout << "test vdl log batching" << endl;
+    LoggerOptions options;
+    options.record_batching.max_values = 64;
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".batched", options);
+        vdl_log_file = logger.log_file();
+
+        for (int i = 0; i < 100; ++i) {
+            for (int j = 0; j < 10; ++j) {
+                logger.add_scalar("batched/metric_" + to_string(j), i,
+                                  0.1 * i * j);
+            }
+        }
+        // the last, partially filled record is emitted here.
+        logger.flush();
+    }
+
+    // 15 full records of 64 values and one of the remaining 40.
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == 16);
+    int n = 0;
+    for (size_t r = 0; r < records.size(); ++r) {
+        Record record;
+        assert(record.ParseFromString(records[r]));
+        assert(record.values_size() == (r + 1 < records.size() ? 64 : 40));
+        for (const auto& value : record.values()) {
+            int i = n / 10, j = n % 10;
+            assert(value.id() == i);
+            assert(value.tag() == "batched/metric_" + to_string(j));
+            assert(value.value() == static_cast<float>(0.1 * i * j));
+            ++n;
+        }
+    }
+    assert(n == 1000);
+
+    return 0;
+}
+
 int test_log_vdl_image(TensorBoardLogger& logger) {
     // todo: MatLab figure, image matrix not supported
     cout << "test vdl log image" << endl;
@@ -262,6 +1269,230 @@ int test_log_vdl_curves(TensorBoardLogger& logger,
     return 0;
 }
 
+int test_log_vdl_curve_values(const char* log_dir) {
+    cout << "test vdl log curve values" << endl;
+    // worked through by hand the way python's compute_curve does it: 1.2 is
+    // still in the last bucket, -0.1 is left out.
+    vector<double> predictions{0.1, 0.3, 0.55, 0.8, 0.95, 1.0, 1.2, -0.1};
+    vector<double> labels{0, 1, 0, 1, 1, 0, 1, 1};
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".curves");
+        vdl_log_file = logger.log_file();
+        logger.add_pr_curve("pr_curve", labels, predictions, 0, 5, 0);
+        logger.add_roc_curve("roc_curve", labels, predictions, 0, 5, 0);
+    }
+    const int64_t tp[] = {4, 4, 3, 3, 1}, fp[] = {3, 2, 2, 1, 1};
+    const int64_t tn[] = {0, 1, 1, 2, 2}, fn[] = {0, 0, 1, 1, 3};
+    const double precision[] = {4.0 / 7, 4.0 / 6, 3.0 / 5, 3.0 / 4, 1.0 / 2};
+    const double recall[] = {1, 1, 0.75, 0.75, 0.25};
+    const double fpr[] = {1, 2.0 / 3, 2.0 / 3, 1.0 / 3, 1.0 / 3};
+    auto records = read_log_messages(vdl_log_file, false);
+    Record pr, roc;
+    assert(pr.ParseFromString(records[0]));
+    assert(roc.ParseFromString(records[1]));
+    const auto& pr_curve = pr.values(0).pr_curve();
+    const auto& roc_curve = roc.values(0).roc_curve();
+    assert(pr_curve.tp_size() == 5 && roc_curve.tp_size() == 5);
+    for (int i = 0; i < 5; ++i) {
+        assert(pr_curve.tp(i) == tp[i] && roc_curve.tp(i) == tp[i]);
+        assert(pr_curve.fp(i) == fp[i] && roc_curve.fp(i) == fp[i]);
+        assert(pr_curve.tn(i) == tn[i] && roc_curve.tn(i) == tn[i]);
+        assert(pr_curve.fn(i) == fn[i] && roc_curve.fn(i) == fn[i]);
+        assert(pr_curve.precision(i) == precision[i]);
+        assert(pr_curve.recall(i) == recall[i]);
+        assert(roc_curve.tpr(i) == recall[i]);
+        assert(roc_curve.fpr(i) == fpr[i]);
+    }
+    return 0;
+}
+
+int test_log_curve_accumulator(const char* log_dir) {
+    cout << "test vdl log curve accumulator" << endl;
+    default_random_engine generator;
+    uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    vector<float> labels(300007), predictions(labels.size());
+    for (size_t i = 0; i < labels.size(); ++i) {
+        predictions[i] = distribution(generator);
+        labels[i] = distribution(generator) < predictions[i];
+    }
+    vector<float> weights(labels.size(), 2.0f);
+    vector<double> all_labels(labels.begin(), labels.end());
+    vector<double> all_predictions(predictions.begin(), predictions.end());
+
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".curve_accumulator");
+        vdl_log_file = logger.log_file();
+        logger.add_pr_curve("pr", all_labels, all_predictions, 0, 50, 0);
+        logger.add_roc_curve("roc", all_labels, all_predictions, 0, 50, 0);
+
+        // mini batches across the blocks, and the same in two halves.
+        CurveAccumulator batched(logger, 50), first(logger, 50),
+            second(logger, 50), weighted(logger, 50);
+        size_t half = labels.size() / 2;
+        for (size_t i = 0; i < labels.size(); i += 4099) {
+            size_t n = min<size_t>(4099, labels.size() - i);
+            batched.update(labels.data() + i, predictions.data() + i, n);
+        }
+        first.update(labels.data(), predictions.data(), half);
+        second.update(labels.data() + half, predictions.data() + half,
+                      labels.size() - half);
+        first.merge(second);
+        weighted.update(labels.data(), predictions.data(), labels.size(),
+                        weights.data());
+        batched.emit_pr_curve("pr", 0, 0);
+        batched.emit_roc_curve("roc", 0, 0);
+        first.emit_pr_curve("pr", 0, 0);
+        weighted.emit_pr_curve("pr", 0, 0);
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records[2] == records[0]);
+    assert(records[3] == records[1]);
+    assert(records[4] == records[0]);
+    Record pr, weighted;
+    assert(pr.ParseFromString(records[0]));
+    assert(weighted.ParseFromString(records[5]));
+    for (int i = 0; i < 50; ++i) {
+        assert(weighted.values(0).pr_curve().tp(i) ==
+               2 * pr.values(0).pr_curve().tp(i));
+        assert(weighted.values(0).pr_curve().precision(i) ==
+               pr.values(0).pr_curve().precision(i));
+    }
+    return 0;
+}
+
+int test_log_class_curves(const char* log_dir) {
+    cout << "test vdl log class curves" << endl;
+    // more samples than a block, against a curve per column.
+    const size_t num_samples = 70001, num_classes = 13;
+    default_random_engine generator;
+    uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    uniform_int_distribution<int32_t> classes(0, num_classes - 1);
+    vector<float> probs(num_samples * num_classes);
+    vector<float> label_matrix(probs.size());
+    vector<int32_t> labels(num_samples);
+    for (size_t i = 0; i < probs.size(); ++i) {
+        probs[i] = distribution(generator);
+        label_matrix[i] = distribution(generator) < probs[i];
+    }
+    for (auto& label : labels) label = classes(generator);
+
+    LoggerOptions options;
+    options.histogram_parallelism.threads = 3;
+    options.histogram_parallelism.min_values = 1;
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".class_curves", options);
+        vdl_log_file = logger.log_file();
+        logger.add_pr_curves("pr", probs.data(), labels.data(), num_samples,
+                             num_classes, 0, 31, 0);
+        logger.add_multi_label_roc_curves("roc", probs.data(),
+                                          label_matrix.data(), num_samples,
+                                          num_classes, 0, 31, 0);
+        // no classes, no record.
+        logger.add_pr_curves("none", probs.data(), labels.data(),
+                             num_samples, 0, 0, 31, 0);
+        logger.add_multi_label_roc_curves("none", probs.data(),
+                                          label_matrix.data(), num_samples,
+                                          0, 0, 31, 0);
+        for (size_t c = 0; c < num_classes; ++c) {
+            vector<double> column(num_samples), class_labels(num_samples),
+                multi_labels(num_samples);
+            for (size_t i = 0; i < num_samples; ++i) {
+                column[i] = probs[i * num_classes + c];
+                class_labels[i] = labels[i] == int32_t(c);
+                multi_labels[i] = label_matrix[i * num_classes + c];
+            }
+            logger.add_pr_curve("pr/" + to_string(c), class_labels, column, 0,
+                                31, 0);
+            logger.add_roc_curve("roc/" + to_string(c), multi_labels, column,
+                                 0, 31, 0);
+        }
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == 2 + 2 * num_classes);
+    Record pr, roc;
+    assert(pr.ParseFromString(records[0]));
+    assert(roc.ParseFromString(records[1]));
+    assert(pr.values_size() == int(num_classes));
+    assert(roc.values_size() == int(num_classes));
+    for (size_t c = 0; c < num_classes; ++c) {
+        Record pr_column, roc_column;
+        assert(pr_column.ParseFromString(records[2 + 2 * c]));
+        assert(roc_column.ParseFromString(records[3 + 2 * c]));
+        assert(pr.values(c).SerializeAsString() ==
+               pr_column.values(0).SerializeAsString());
+        assert(roc.values(c).SerializeAsString() ==
+               roc_column.values(0).SerializeAsString());
+    }
+    return 0;
+}
+
+int test_log_fine_curves(const char* log_dir) {
+    cout << "test vdl log fine curves" << endl;
+    // thousands of thresholds, from floats in place and from doubles, and
+    // per class in chunks of a few classes.
+    const size_t num_samples = 70001, num_classes = 13;
+    const int num_thresholds = 4096;
+    default_random_engine generator;
+    uniform_real_distribution<float> distribution(0.0f, 1.0f);
+    vector<float> probs(num_samples * num_classes);
+    vector<float> label_matrix(probs.size());
+    for (size_t i = 0; i < probs.size(); ++i) {
+        probs[i] = distribution(generator);
+        label_matrix[i] = distribution(generator) < probs[i];
+    }
+    vector<double> labels(label_matrix.begin(),
+                          label_matrix.begin() + num_samples);
+    vector<double> predictions(probs.begin(), probs.begin() + num_samples);
+
+    string vdl_log_file;
+    {
+        TensorBoardLogger logger(log_dir, true, ".fine_curves");
+        vdl_log_file = logger.log_file();
+        logger.add_pr_curve("pr", labels, predictions, 0, num_thresholds, 0);
+        logger.add_pr_curve("pr", label_matrix.data(), probs.data(),
+                            num_samples, 0, num_thresholds, 0);
+        logger.add_roc_curve("roc", label_matrix.data(), probs.data(),
+                             num_samples, 0, num_thresholds, 0);
+        logger.add_multi_label_roc_curves("roc", probs.data(),
+                                          label_matrix.data(), num_samples,
+                                          num_classes, 0, num_thresholds, 0);
+        for (size_t c = 0; c < num_classes; ++c) {
+            vector<float> column(num_samples), column_labels(num_samples);
+            for (size_t i = 0; i < num_samples; ++i) {
+                column[i] = probs[i * num_classes + c];
+                column_labels[i] = label_matrix[i * num_classes + c];
+            }
+            logger.add_roc_curve("roc/" + to_string(c), column_labels.data(),
+                                 column.data(), num_samples, 0,
+                                 num_thresholds, 0);
+        }
+    }
+    auto records = read_log_messages(vdl_log_file, false);
+    assert(records.size() == 4 + num_classes);
+    assert(records[1] == records[0]);
+    Record pr, roc, classes;
+    assert(pr.ParseFromString(records[0]));
+    assert(roc.ParseFromString(records[2]));
+    assert(classes.ParseFromString(records[3]));
+    const auto& pr_curve = pr.values(0).pr_curve();
+    assert(pr_curve.tp_size() == num_thresholds);
+    int64_t positives = 0;
+    for (auto label : labels) positives += label > 0;
+    assert(pr_curve.tp(0) == positives);
+    assert(pr_curve.tp(0) + pr_curve.fp(0) == int64_t(num_samples));
+    assert(roc.values(0).roc_curve().tpr_size() == num_thresholds);
+    for (size_t c = 0; c < num_classes; ++c) {
+        Record column;
+        assert(column.ParseFromString(records[4 + c]));
+        assert(classes.values(c).SerializeAsString() ==
+               column.values(0).SerializeAsString());
+    }
+    return 0;
+}
+
 int test_log_vdl(TensorBoardLogger& logger) {
     default_random_engine generator;
     normal_distribution<double> default_distribution(0, 1.0);
@@ -287,7 +1518,75 @@ int test_vdl(const char* log_dir) {
 int main(int argc, char* argv[]) {
     GOOGLE_PROTOBUF_VERIFY_VERSION;
 
-    int ret = test_log("./demo/tfevents.pb");
+    int ret = test_crc32c();
+    assert(ret == 0);
+
+    ret = test_bucket_index();
+    assert(ret == 0);
+
+    ret = test_log("./demo/tfevents.pb");
+    assert(ret == 0);
+
+    ret = test_log_async("./demo/tfevents_async.pb");
+    assert(ret == 0);
+
+    ret = test_log_flush_policy("./demo/tfevents_flush.pb");
+    assert(ret == 0);
+
+    ret = test_log_concurrent("./demo/tfevents_concurrent.pb");
+    assert(ret == 0);
+
+    ret = test_log_scalar_encoding("./demo/tfevents_encoding.pb", "./logs/out");
+    assert(ret == 0);
+    ret = test_log_from_path_encoding("./demo/tfevents_from_path.pb");
+    assert(ret == 0);
+
+    ret = test_log_scalars("./demo/tfevents_scalars.pb", "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_tag_handles("./demo/tfevents_handles.pb", "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_wall_clock("./demo/tfevents_clock.pb", "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_resume("./demo/tfevents_resume.pb", "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_rotation("./demo/tfevents_rotation.pb", "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_parallel_histograms("./demo/tfevents_parallel.pb",
+                                       "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_histogram_accumulator("./demo/tfevents_accumulator.pb",
+                                         "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_vdl_histogram_bins("./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_sampled_histograms("./demo/tfevents_sampled.pb",
+                                      "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_low_precision_histograms("./demo/tfevents_low_precision.pb",
+                                            "./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_vdl_curve_values("./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_curve_accumulator("./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_class_curves("./logs/out");
+    assert(ret == 0);
+    ret = test_log_fine_curves("./logs/out");
+    assert(ret == 0);
+
+    ret = test_log_vdl_batching("./logs/out");
     assert(ret == 0);
 
     ret = test_vdl("./logs/out");